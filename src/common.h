@@ -0,0 +1,189 @@
+/* src/common.h
+   Pieces shared by sender and receiver.
+   - Wire format: every datagram starts with a 12 byte header
+       4 bytes stream_id (BE)
+       4 bytes sequence  (BE)
+       4 bytes flags     (BE) - bit0 = final
+     followed by up to PAYLOAD_SIZE bytes of the file.
+   - Header sizes of the raw frame backends (AF_PACKET, AF_XDP).
+   - parse_bitrate() for -R and per-stream rates.
+   - XskRing, one mapped AF_XDP ring.
+   - Uring, a minimal io_uring over the raw syscalls, so the build needs no
+     liburing.
+*/
+#ifndef MCAST_COMMON_H
+#define MCAST_COMMON_H
+
+#include <errno.h>
+#include <linux/if_xdp.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static constexpr size_t PAYLOAD_SIZE = 1200;
+static constexpr size_t HDR_LEN = 12;
+static constexpr uint32_t FLAG_FINAL = 1;
+static constexpr size_t ETH_LEN = 14, IP6_LEN = 40, UDP_LEN = 8; // raw frame backends
+static constexpr size_t L2L4_LEN = ETH_LEN + IP6_LEN + UDP_LEN;
+
+// Parses a bit rate such as "8M", "1.5G" or "640k" into bits per second.
+inline double parse_bitrate(const std::string &s) {
+    size_t used = 0;
+    double v = std::stod(s, &used);
+    std::string unit = s.substr(used);
+    if (unit == "k" || unit == "K") v *= 1e3;
+    else if (unit == "m" || unit == "M") v *= 1e6;
+    else if (unit == "g" || unit == "G") v *= 1e9;
+    else if (!unit.empty()) throw std::invalid_argument("bad bit rate unit: " + unit);
+    return v;
+}
+
+// One AF_XDP ring shared with the kernel: a power-of-two array of T plus
+// producer/consumer indices and flags, located via XDP_MMAP_OFFSETS.
+template <typename T>
+struct XskRing {
+    uint32_t *producer = nullptr, *consumer = nullptr, *flags = nullptr;
+    T *ring = nullptr;
+    uint32_t mask = 0;
+
+    ~XskRing() {
+        if (map_) munmap(map_, map_len_);
+    }
+
+    bool map(int fd, const struct xdp_ring_offset &off, uint32_t n, off_t pgoff) {
+        map_len_ = off.desc + n * sizeof(T);
+        void *p = mmap(nullptr, map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        if (p == MAP_FAILED) { perror("mmap(AF_XDP ring)"); return false; }
+        map_ = p;
+        char *base = static_cast<char*>(p);
+        producer = reinterpret_cast<uint32_t*>(base + off.producer);
+        consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+        flags = reinterpret_cast<uint32_t*>(base + off.flags);
+        ring = reinterpret_cast<T*>(base + off.desc);
+        mask = n - 1;
+        return true;
+    }
+
+private:
+    void *map_ = nullptr;
+    size_t map_len_ = 0;
+};
+
+// Minimal io_uring over the raw syscalls. The registered buffer belongs to
+// the ring and is freed only after the ring fd is closed, so requests
+// still in flight never touch freed memory.
+class Uring {
+public:
+    ~Uring() {
+        if (sqes_) munmap(sqes_, sqes_sz_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_sz_);
+        if (sq_ptr_) munmap(sq_ptr_, sq_sz_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool init(unsigned int entries) {
+        struct io_uring_params p{};
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0) return false;
+        sq_sz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_sz_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_sz_ = cq_sz_ = std::max(sq_sz_, cq_sz_);
+        sq_ptr_ = map(sq_sz_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single ? sq_ptr_ : map(cq_sz_, IORING_OFF_CQ_RING);
+        sqes_sz_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(map(sqes_sz_, IORING_OFF_SQES));
+        if (!sq_ptr_ || !cq_ptr_ || !sqes_) return false;
+
+        char *sq = static_cast<char*>(sq_ptr_), *cq = static_cast<char*>(cq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        sq_entries_ = p.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+        tail_ = *sq_tail_;
+        return true;
+    }
+
+    int register_files(const int *fds, unsigned int n) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, fds, n));
+    }
+    // Replaces fixed file index with fd (-1 empties it).
+    int update_file(unsigned int index, int fd) {
+        struct io_uring_files_update up{};
+        up.offset = index;
+        up.fds = reinterpret_cast<uint64_t>(&fd);
+        return static_cast<int>(syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE, &up, 1));
+    }
+    // Allocates len bytes and registers them as fixed buffer 0. Returns
+    // the buffer, or nullptr with errno set.
+    char *register_buffer(size_t len) {
+        buf_.assign(len, 0);
+        struct iovec reg{buf_.data(), len};
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, &reg, 1) < 0) return nullptr;
+        return buf_.data();
+    }
+
+    // Next free SQE (zeroed), or nullptr if the submission ring is full.
+    struct io_uring_sqe *get_sqe() {
+        if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) return nullptr;
+        unsigned idx = tail_ & sq_mask_;
+        sq_array_[idx] = idx;
+        ++tail_;
+        std::memset(&sqes_[idx], 0, sizeof(sqes_[idx]));
+        return &sqes_[idx];
+    }
+
+    // SQEs not yet consumed by the kernel.
+    unsigned int queued() const { return tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE); }
+
+    // Publishes queued SQEs and optionally waits for wait_nr completions.
+    // Also submits SQEs left over from an interrupted call.
+    int enter(unsigned int wait_nr) {
+        unsigned to_submit = queued();
+        __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, flags, nullptr, 0));
+    }
+
+    struct io_uring_cqe *peek_cqe() {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return nullptr;
+        return &cqes_[head & cq_mask_];
+    }
+    void cqe_seen() { __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE); }
+
+private:
+    void *map(size_t len, off_t off) {
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, off);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int fd_ = -1;
+    void *sq_ptr_ = nullptr, *cq_ptr_ = nullptr;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sq_sz_ = 0, cq_sz_ = 0, sqes_sz_ = 0;
+    unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_array_ = nullptr;
+    unsigned sq_mask_ = 0, sq_entries_ = 0, tail_ = 0;
+    unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, cq_mask_ = 0;
+    struct io_uring_cqe *cqes_ = nullptr;
+    std::vector<char> buf_;
+};
+
+#endif
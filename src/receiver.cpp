@@ -4,79 +4,2263 @@
    - Or use -s all to accept any stream; files are created per stream.
    - Output pattern: -o "out_{id}.mp4" (use {id} placeholder for per-stream files)
    - If subscribing to a single stream and -o "-" is given, data goes to stdout.
+   - Datagrams are pulled with recvmmsg(), up to -b N per syscall, into a
+     preallocated packet array and then processed as a batch.
+   - With -G the socket enables UDP_GRO: the kernel may hand over a run of
+     same-sized datagrams as one buffer, which is walked segment by segment
+     (segment size from the UDP_GRO control message).
+   - The socket is non-blocking and driven by an epoll loop; a timerfd fires
+     at the earliest final-marker deadline and a signalfd turns SIGINT/SIGTERM
+     into a clean shutdown, so completion and timeouts are seen at once.
+   - With -w N, N worker threads each own a socket on the same port
+     (SO_REUSEPORT) and a classic BPF filter that passes only the stream_ids
+     with stream_id % N == worker, so every stream lives on one thread and
+     the reassembly needs no locks.
+   - The subscription list is compiled into that socket filter too, so
+     unsubscribed streams are dropped in the kernel. With -s @file the list
+     is re-read and the filters rebuilt on SIGHUP.
+   - With -B packet frames are read from an AF_PACKET RX ring (TPACKET_V3)
+     on the interface instead of a UDP socket; a BPF filter selects our
+     group, port and streams and the headers are parsed in place.
+   - With -B xdp an XDP program (assembled here, loaded with bpf()) redirects
+     our group/port/streams into one AF_XDP socket per RX queue, each run by
+     its own worker, and datagrams are reassembled straight from UMEM.
+   - With -P usec the workers busy-poll (SO_BUSY_POLL/SO_PREFER_BUSY_POLL)
+     in a non-blocking spin loop instead of sleeping in epoll; -C pins them
+     to cores and -F runs them SCHED_FIFO. -L measures the latency from the
+     kernel's receive timestamp to the datagram being processed.
+   - The socket receive buffer is sized for -R bitrate (SO_RCVBUFFORCE if
+     allowed) and SO_RXQ_OVFL reports datagrams the kernel dropped on a full
+     buffer, per stream and in total, apart from loss in the network.
+   - Datagrams are received into the slots of a slab-allocated packet pool
+     and an out-of-order datagram is kept by slot index, so the steady-state
+     receive path makes no heap allocations (operator new calls are counted
+     and reported at exit).
+   - Reordering uses a per-stream ring of -W slots indexed by seq & mask with
+     a presence bitmap; a datagram beyond the window gives up the oldest
+     missing sequences instead of buffering without bound.
+   - With -m pwrite every payload is written at once at its file offset
+     (seq-1)*PAYLOAD_SIZE with pwrite(); arrival is kept in a per-stream
+     bitmap and nothing is buffered for reordering.
+   - With -m mmap the output is preallocated with fallocate() (to the -z size
+     hint, or in large extents) and mapped; payloads are copied into the
+     mapping at their offsets and writeback is started in batches with
+     sync_file_range().
+   - With -A each worker hands its writes to a writer thread of its own
+     through a lock-free single-producer/single-consumer ring of -Q bytes,
+     so a stalled disk delays the writer and not the socket.
+   - With -m uring the payloads are copied into a registered buffer and
+     written with WRITE_FIXED to fixed files through io_uring, the writes
+     of all streams of a receive batch in one io_uring_enter(); -Y queues
+     an fsync behind each file's writes every that many bytes.
 */
 #include <arpa/inet.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <linux/io_uring.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-static constexpr size_t PAYLOAD_SIZE = 1200;
-static constexpr size_t HDR_LEN = 12;
-static constexpr uint32_t FLAG_FINAL = 1;
+#include "common.h"
+
 static constexpr size_t MAX_PKT = HDR_LEN + PAYLOAD_SIZE;
+static constexpr unsigned int DEFAULT_BATCH = 64;
+static constexpr size_t GRO_BUF_SIZE = 65536; // largest coalesced UDP payload
+static constexpr unsigned int MAX_WORKERS = 64;
+static constexpr size_t MAX_FILTER_IDS = 1000; // 2 BPF insns each, at most 4096
+static constexpr double RCVBUF_WINDOW_S = 0.2;      // receive buffer holds 200 ms at -R
+static constexpr int MIN_RCVBUF = 256 * 1024;
+static constexpr uint32_t DEFAULT_WINDOW = 4096;    // reorder window, datagrams per stream
+static constexpr uint32_t MAX_WINDOW = 1u << 20;
+static constexpr uint64_t MAP_EXTENT = 64ull << 20;  // -m mmap growth step without -z
+static constexpr uint64_t MAP_FLUSH = 16ull << 20;   // bytes copied between writeback kicks
+static constexpr size_t DEFAULT_QUEUE_MEM = 64 << 20; // -A ring budget of all workers
+// -m uring: payload slots in the registered buffer, ring size (slots plus
+// fsyncs) and size of the fixed file table.
+static constexpr unsigned int URING_SLOTS = 1024;
+static constexpr unsigned int URING_ENTRIES = 2 * URING_SLOTS;
+static constexpr unsigned int URING_FILES = 1024;
+
+// Every operator new of the process, to show that the receive path does
+// not allocate once it is warmed up. Direct malloc(), realloc() and
+// posix_memalign() calls (libc internals) are not seen, so the figure is
+// reported as operator new calls. Kept out of line, or GCC pairs an
+// inlined malloc() or free() with a counterpart it does not recognise.
+static std::atomic<uint64_t> g_new_calls{0};
+
+__attribute__((noinline)) void *operator new(size_t n) {
+    g_new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void *operator new[](size_t n) { return operator new(n); }
+__attribute__((noinline)) void operator delete(void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+// Fixed-size packet buffers, allocated a slab at a time and recycled
+// through a free list, so the pool stops allocating once it has grown to
+// the reorder depth the streams need. Slots are addressed by index.
+class PacketPool {
+public:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr size_t SLOT_SIZE = (MAX_PKT + 63) & ~size_t(63);
+    static constexpr uint32_t SLAB_SLOTS = 1024;
+
+    PacketPool() { grow(); }
+
+    uint32_t acquire() {
+        if (free_.empty()) grow();
+        uint32_t slot = free_.back();
+        free_.pop_back();
+        peak_ = std::max(peak_, slabs_.size() * SLAB_SLOTS - free_.size());
+        return slot;
+    }
+
+    void release(uint32_t slot) { free_.push_back(slot); }
+
+    char *data(uint32_t slot) { return slabs_[slot / SLAB_SLOTS].get() + size_t(slot % SLAB_SLOTS) * SLOT_SIZE; }
+
+    size_t slabs() const { return slabs_.size(); }
+    size_t peak() const { return peak_; }
+
+private:
+    void grow() {
+        uint32_t base = static_cast<uint32_t>(slabs_.size()) * SLAB_SLOTS;
+        slabs_.emplace_back(new char[size_t(SLAB_SLOTS) * SLOT_SIZE]);
+        free_.reserve(slabs_.size() * SLAB_SLOTS);
+        for (uint32_t k = SLAB_SLOTS; k-- > 0;) free_.push_back(base + k);
+    }
+
+    std::vector<std::unique_ptr<char[]>> slabs_;
+    std::vector<uint32_t> free_;
+    size_t peak_ = 0;
+};
+
+// Reorder window of one stream: a power-of-two ring of out-of-order
+// datagrams (pool slot and length, header included) indexed by seq & mask,
+// and a presence bitmap, so the in-order run behind a filled gap is found
+// 64 sequences per bit scan. The caller keeps every stored seq within
+// size() of the next expected one.
+class ReorderWindow {
+public:
+    struct Entry {
+        uint32_t slot;
+        uint32_t len;
+    };
+
+    // size: a power of two, at least 64.
+    void reset(uint32_t size) {
+        mask_ = size - 1;
+        entries_.assign(size, Entry{PacketPool::NO_SLOT, 0});
+        bits_.assign(size / 64, 0);
+        count_ = 0;
+    }
+
+    uint32_t size() const { return mask_ + 1; }
+    size_t count() const { return count_; }
+
+    bool present(uint32_t seq) const {
+        uint32_t i = seq & mask_;
+        return (bits_[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void put(uint32_t seq, Entry e) {
+        uint32_t i = seq & mask_;
+        entries_[i] = e;
+        bits_[i >> 6] |= uint64_t(1) << (i & 63);
+        ++count_;
+    }
+
+    Entry take(uint32_t seq) {
+        uint32_t i = seq & mask_;
+        bits_[i >> 6] &= ~(uint64_t(1) << (i & 63));
+        --count_;
+        return entries_[i];
+    }
+
+    // Number of consecutive present sequences from seq on.
+    uint32_t run(uint32_t seq) const {
+        uint32_t n = 0, i = seq & mask_;
+        while (n < size()) {
+            uint32_t bit = i & 63;
+            uint64_t absent = ~bits_[i >> 6] >> bit;
+            uint32_t ones = absent ? static_cast<uint32_t>(__builtin_ctzll(absent)) : 64 - bit;
+            n += ones;
+            if (ones < 64 - bit) break;
+            i = (i + ones) & mask_;
+        }
+        return std::min(n, size());
+    }
+
+private:
+    uint32_t mask_ = 0;
+    std::vector<Entry> entries_;
+    std::vector<uint64_t> bits_;
+    size_t count_ = 0;
+};
+
+// Sequences that have arrived, for -m pwrite: one bit per sequence from
+// base() on. Whole words below the lowest missing sequence are dropped
+// now and then, so the bitmap spans only the reorder distance.
+class SeqBitmap {
+public:
+    // Sequences the bitmap may span from base() on (8 MB of bitmap, about
+    // 80 GB of output); the caller drops datagrams beyond it.
+    static constexpr uint32_t MAX_SPAN = 1u << 26;
+
+    bool fits(uint32_t seq) const { return seq >= base_ && seq - base_ < MAX_SPAN; }
+
+    bool test(uint32_t seq) const {
+        if (seq < base_) return true;
+        size_t w = (seq - base_) >> 6;
+        return w < words_.size() && ((words_[w] >> (seq & 63)) & 1);
+    }
+
+    // seq must fit().
+    void set(uint32_t seq) {
+        size_t w = (seq - base_) >> 6;
+        if (w >= words_.size()) words_.resize(std::min(std::max(w + 1, words_.size() * 2), size_t(MAX_SPAN / 64)), 0);
+        words_[w] |= uint64_t(1) << (seq & 63);
+    }
+
+    // Lowest sequence at or above from (>= base()) that has not arrived.
+    uint32_t first_clear(uint32_t from) const {
+        size_t w = (from - base_) >> 6;
+        uint64_t absent = ~uint64_t(0) << (from & 63);
+        if (w < words_.size()) absent &= ~words_[w];
+        while (!absent) {
+            ++w;
+            absent = w < words_.size() ? ~words_[w] : ~uint64_t(0);
+        }
+        return base_ + static_cast<uint32_t>(w * 64 + __builtin_ctzll(absent));
+    }
+
+    // Forgets the words below seq once they make up half the bitmap.
+    void trim(uint32_t seq) {
+        size_t drop = (seq - base_) >> 6;
+        if (drop == 0 || drop * 2 < words_.size()) return;
+        drop = std::min(drop, words_.size());
+        words_.erase(words_.begin(), words_.begin() + static_cast<std::ptrdiff_t>(drop));
+        base_ += static_cast<uint32_t>(drop * 64);
+    }
+
+    uint32_t base() const { return base_; }
+
+private:
+    uint32_t base_ = 0; // a multiple of 64
+    std::vector<uint64_t> words_;
+};
+
+// Output file of -m mmap. The file is extended with fallocate(), so its
+// blocks are reserved in few large extents, and mapped shared; payloads
+// are copied into the mapping. Every MAP_FLUSH bytes the range written
+// since the last time is handed to writeback with sync_file_range(), and
+// close() trims the file to the end of the data. The fd is not owned.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    // size_hint: expected file size, reserved at once (0: grow as needed).
+    bool open(int fd, uint64_t size_hint) {
+        fd_ = fd;
+        return size_hint == 0 || grow(size_hint);
+    }
+
+    bool write(uint64_t off, const char *p, size_t n) {
+        if (off + n > len_ && !grow((off + n + MAP_EXTENT - 1) / MAP_EXTENT * MAP_EXTENT)) return false;
+        std::memcpy(base_ + off, p, n);
+        end_ = std::max(end_, off + n);
+        dirty_lo_ = std::min(dirty_lo_, off);
+        dirty_hi_ = std::max(dirty_hi_, off + n);
+        if ((dirty_ += n) >= MAP_FLUSH) flush();
+        return true;
+    }
+
+    void close() {
+        if (fd_ < 0) return;
+        flush();
+        if (base_) munmap(base_, len_);
+        if (ftruncate(fd_, static_cast<off_t>(end_)) != 0) perror("ftruncate");
+        base_ = nullptr;
+        len_ = end_ = 0;
+        fd_ = -1;
+    }
+
+private:
+    // Extends file and mapping to size bytes.
+    bool grow(uint64_t size) {
+        if (fallocate(fd_, 0, static_cast<off_t>(len_), static_cast<off_t>(size - len_)) != 0 &&
+            (errno != EOPNOTSUPP || ftruncate(fd_, static_cast<off_t>(size)) != 0)) {
+            perror("fallocate");
+            return false;
+        }
+        void *m = base_ ? mremap(base_, len_, size, MREMAP_MAYMOVE)
+                        : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+        base_ = static_cast<char *>(m);
+        len_ = size;
+        return true;
+    }
+
+    // Starts writeback of the range written since the last flush.
+    void flush() {
+        if (dirty_hi_ > dirty_lo_ &&
+            sync_file_range(fd_, static_cast<off_t>(dirty_lo_), static_cast<off_t>(dirty_hi_ - dirty_lo_), SYNC_FILE_RANGE_WRITE) != 0) {
+            perror("sync_file_range");
+        }
+        dirty_lo_ = UINT64_MAX;
+        dirty_hi_ = dirty_ = 0;
+    }
+
+    int fd_ = -1;
+    char *base_ = nullptr;
+    uint64_t len_ = 0;   // mapped and allocated
+    uint64_t end_ = 0;   // end of the data written
+    uint64_t dirty_lo_ = UINT64_MAX, dirty_hi_ = 0, dirty_ = 0;
+};
+
+// How the payloads reach the output file.
+enum class OutputMode {
+    STREAM, // in sequence order through an ofstream (or stdout)
+    PWRITE, // at their offsets with pwrite(), as they arrive
+    MMAP,   // at their offsets into a preallocated mapping, as they arrive
+    URING,  // at their offsets through io_uring, as they arrive
+};
+
+struct OutputOptions {
+    std::string pattern; // "{id}" is replaced by the stream_id, "-" is stdout
+    OutputMode mode = OutputMode::STREAM;
+    uint64_t size_hint = 0;  // expected size of each file, -m mmap
+    uint64_t sync_every = 0; // fsync checkpoint per file, -m uring
+};
+
+// Output of one stream: stdout or an ofstream appended to in sequence
+// order (-m stream), or a file written by offset (-m pwrite/mmap; with -m
+// uring the fd is written through the UringWriter). Used by the receiving
+// thread, or with -A only by its writer thread.
+class OutputFile {
+public:
+    OutputFile() = default;
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+    ~OutputFile() { close(); }
+
+    bool open(const std::string &fname, const OutputOptions &opt) {
+        mode_ = opt.mode;
+        if (mode_ == OutputMode::STREAM) {
+            fout_.open(fname, std::ios::binary);
+            return open_ = static_cast<bool>(fout_);
+        }
+        fd_ = ::open(fname.c_str(), (mode_ == OutputMode::MMAP ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        if (mode_ == OutputMode::MMAP && !map_.open(fd_, opt.size_hint)) {
+            close();
+            return false;
+        }
+        return open_ = true;
+    }
+
+    void open_stdout() { stdout_ = open_ = true; }
+
+    int fd() const { return fd_; }
+
+    // off: file offset of p; appends (-m stream, stdout) ignore it.
+    void write(uint64_t off, const char *p, size_t n) {
+        if (!open_ || n == 0) return;
+        if (stdout_) {
+            std::cout.write(p, n);
+            std::cout.flush();
+        } else if (mode_ == OutputMode::STREAM) {
+            fout_.write(p, n);
+        } else if (mode_ == OutputMode::MMAP) {
+            if (!map_.write(off, p, n)) close();
+        } else {
+            pwrite_all(off, p, n);
+        }
+    }
+
+    void close() {
+        if (fout_.is_open()) fout_.close();
+        map_.close();
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        open_ = false;
+    }
+
+private:
+    void pwrite_all(uint64_t off, const char *p, size_t n) {
+        for (size_t done = 0; done < n;) {
+            ssize_t w = pwrite(fd_, p + done, n - done, static_cast<off_t>(off + done));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                perror("pwrite");
+                return;
+            }
+            done += static_cast<size_t>(w);
+        }
+    }
+
+    OutputMode mode_ = OutputMode::STREAM;
+    bool stdout_ = false;
+    bool open_ = false;
+    std::ofstream fout_;
+    int fd_ = -1;
+    MappedFile map_;
+};
+
+// Entry of an AsyncWriter ring: a payload chunk copied in for its file,
+// the close of a file, or the end of the writer.
+struct WriteOp {
+    enum Kind : uint32_t { WRITE, CLOSE, STOP };
+    Kind kind;
+    uint32_t len;
+    OutputFile *file;
+    uint64_t off;
+    char data[PAYLOAD_SIZE];
+};
+
+// -A: a writer thread fed by one receiving thread through a single-
+// producer/single-consumer ring of preallocated WriteOps, sized to the
+// memory budget. The producer waits when the ring is full (counted as a
+// stall); the writer sleeps on an eventfd when it is empty, which the
+// producer only signals after the writer has said so.
+class AsyncWriter {
+public:
+    explicit AsyncWriter(size_t budget) : wake_fd_(eventfd(0, EFD_CLOEXEC)) {
+        size_t n = 64;
+        while (n * 2 * sizeof(WriteOp) <= budget) n <<= 1;
+        ops_.reset(new WriteOp[n]);
+        mask_ = n - 1;
+    }
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter &operator=(const AsyncWriter &) = delete;
+    ~AsyncWriter() {
+        stop();
+        if (wake_fd_ >= 0) ::close(wake_fd_);
+    }
+
+    bool start() {
+        if (wake_fd_ < 0) return false;
+        thread_ = std::thread(&AsyncWriter::run, this);
+        return true;
+    }
+
+    // Queues n bytes for file at offset off, one entry per PAYLOAD_SIZE.
+    void write(OutputFile *file, uint64_t off, const char *p, size_t n) {
+        while (n > 0) {
+            size_t len = std::min(n, PAYLOAD_SIZE);
+            WriteOp &op = next();
+            op.kind = WriteOp::WRITE;
+            op.file = file;
+            op.off = off;
+            op.len = static_cast<uint32_t>(len);
+            std::memcpy(op.data, p, len);
+            publish();
+            off += len;
+            p += len;
+            n -= len;
+        }
+    }
+
+    // Closes file after the writes queued before.
+    void close(OutputFile *file) {
+        WriteOp &op = next();
+        op.kind = WriteOp::CLOSE;
+        op.file = file;
+        publish();
+    }
+
+    // Lets the writer finish what is queued and joins it.
+    void stop() {
+        if (!thread_.joinable()) return;
+        next().kind = WriteOp::STOP;
+        publish();
+        thread_.join();
+    }
+
+    // Prints the queue metrics; after stop().
+    void report(unsigned int index) const {
+        std::cerr << "Writer " << index << ": " << queued_ << " queue entries, depth avg "
+                  << (queued_ ? double(depth_sum_) / double(queued_) : 0.0) << " max " << max_depth_ << " of " << mask_ + 1
+                  << " (" << (mask_ + 1) * sizeof(WriteOp) / 1024 << " KB), " << stalls_ << " stall(s) on a full queue, "
+                  << stall_ns_ / 1e6 << " ms in total, max " << max_stall_ns_ / 1e6 << " ms\n";
+    }
+
+private:
+    // The entry at the tail, once there is room for it.
+    WriteOp &next() {
+        if (tail_ - head_seen_ > mask_) {
+            head_seen_ = head_.load(std::memory_order_acquire);
+            if (tail_ - head_seen_ > mask_) {
+                auto t0 = std::chrono::steady_clock::now();
+                do {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    head_seen_ = head_.load(std::memory_order_acquire);
+                } while (tail_ - head_seen_ > mask_);
+                uint64_t ns = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+                ++stalls_;
+                stall_ns_ += ns;
+                max_stall_ns_ = std::max(max_stall_ns_, ns);
+            }
+        }
+        return ops_[tail_ & mask_];
+    }
+
+    void publish() {
+        uint64_t depth = ++tail_ - head_.load(std::memory_order_relaxed);
+        ++queued_;
+        depth_sum_ += depth;
+        max_depth_ = std::max(max_depth_, depth);
+        tail_pub_.store(tail_, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) {
+            uint64_t one = 1;
+            if (::write(wake_fd_, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        }
+    }
+
+    void run() {
+        uint64_t head = 0, tail = 0;
+        for (;;) {
+            if (head == tail) {
+                tail = tail_pub_.load(std::memory_order_acquire);
+                if (head == tail) {
+                    sleeping_.store(true);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (tail_pub_.load(std::memory_order_acquire) == head) {
+                        uint64_t n;
+                        if (::read(wake_fd_, &n, sizeof(n)) < 0 && errno != EINTR) perror("read(eventfd)");
+                    }
+                    sleeping_.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            WriteOp &op = ops_[head & mask_];
+            if (op.kind == WriteOp::STOP) break;
+            if (op.kind == WriteOp::WRITE) op.file->write(op.off, op.data, op.len);
+            else op.file->close();
+            head_.store(++head, std::memory_order_release);
+        }
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    std::unique_ptr<WriteOp[]> ops_;
+    uint64_t mask_ = 0;
+    int wake_fd_;
+    std::thread thread_;
+    alignas(64) std::atomic<uint64_t> head_{0};     // consumed, written by the writer
+    alignas(64) std::atomic<uint64_t> tail_pub_{0}; // published, written by the producer
+    std::atomic<bool> sleeping_{false};
+    // producer side
+    alignas(64) uint64_t tail_ = 0;
+    uint64_t head_seen_ = 0;
+    uint64_t queued_ = 0, depth_sum_ = 0, max_depth_ = 0;
+    uint64_t stalls_ = 0, stall_ns_ = 0, max_stall_ns_ = 0;
+};
+
+// -m uring: file writes of one worker through io_uring. A payload is
+// copied into a slot of the registered buffer and written with
+// WRITE_FIXED; output files sit in a sparse fixed file table (beyond
+// URING_FILES they are used by fd). SQEs of all streams collect until
+// submit(), once per receive batch, which also reaps the completions.
+class UringWriter {
+public:
+    static constexpr uint64_t FSYNC_TAG = ~uint64_t(0);
+
+    bool init() {
+        if (!ring_.init(URING_ENTRIES)) return false;
+        buf_ = ring_.register_buffer(size_t(URING_SLOTS) * PAYLOAD_SIZE);
+        std::vector<int> sparse(URING_FILES, -1);
+        if (!buf_ || ring_.register_files(sparse.data(), URING_FILES) < 0) return false;
+        ops_.resize(URING_SLOTS);
+        for (unsigned int i = URING_SLOTS; i > 0; --i) free_slots_.push_back(i - 1);
+        for (unsigned int i = URING_FILES; i > 0; --i) free_files_.push_back(static_cast<int>(i - 1));
+        return true;
+    }
+
+    // Fixed file index now standing for fd, or -1 if the table is full.
+    int add_file(int fd) {
+        if (free_files_.empty()) return -1;
+        int index = free_files_.back();
+        if (ring_.update_file(static_cast<unsigned int>(index), fd) < 0) {
+            perror("io_uring_register(FILES_UPDATE)");
+            return -1;
+        }
+        free_files_.pop_back();
+        return index;
+    }
+
+    // Waits for every write queued so far, fsyncs fd if sync is set and
+    // frees its fixed index.
+    void remove_file(int fd, int fixed, bool sync) {
+        if (sync) fsync(fd, fixed);
+        wait_all();
+        if (fixed < 0) return;
+        if (ring_.update_file(static_cast<unsigned int>(fixed), -1) < 0) perror("io_uring_register(FILES_UPDATE)");
+        free_files_.push_back(fixed);
+    }
+
+    void write(int fd, int fixed, uint64_t off, const char *p, size_t n) {
+        while (n > 0) {
+            size_t len = std::min(n, PAYLOAD_SIZE);
+            while (free_slots_.empty()) reap(1);
+            unsigned int slot = free_slots_.back();
+            free_slots_.pop_back();
+            std::memcpy(buf_ + size_t(slot) * PAYLOAD_SIZE, p, len);
+            ops_[slot] = {fd, fixed, off, static_cast<uint32_t>(len), 0};
+            queue_write(slot);
+            ++writes_;
+            off += len;
+            p += len;
+            n -= len;
+        }
+    }
+
+    // Queues an fdatasync of fd that starts once everything queued before
+    // it has completed (IOSQE_IO_DRAIN).
+    void fsync(int fd, int fixed) {
+        struct io_uring_sqe *sqe = sqe_for(fd, fixed);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->flags |= IOSQE_IO_DRAIN;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = FSYNC_TAG;
+        ++fsyncs_;
+    }
+
+    // Submits what is queued and reaps finished writes without waiting.
+    void submit() {
+        if (ring_.queued() > 0) reap(0);
+    }
+
+    void wait_all() {
+        while (outstanding_ > 0) reap(1);
+    }
+
+    void report(unsigned int index) const {
+        std::cerr << "io_uring writer " << index << ": " << writes_ << " writes, " << fsyncs_ << " fsyncs in " << enters_
+                  << " io_uring_enter calls (" << (enters_ ? double(writes_) / double(enters_) : 0.0) << " writes/call), "
+                  << waits_ << " waits for a free slot";
+        if (resubmits_) std::cerr << ", " << resubmits_ << " short writes resubmitted";
+        if (errors_) std::cerr << ", " << errors_ << " failed";
+        std::cerr << "\n";
+    }
+
+private:
+    // Write held in a slot; done bytes of it have reached the file.
+    struct SlotOp {
+        int fd;
+        int fixed;
+        uint64_t off;
+        uint32_t len;
+        uint32_t done;
+    };
+
+    // Queues a WRITE_FIXED of what is left of the slot's write.
+    void queue_write(unsigned int slot) {
+        const SlotOp &op = ops_[slot];
+        struct io_uring_sqe *sqe = sqe_for(op.fd, op.fixed);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(buf_ + size_t(slot) * PAYLOAD_SIZE + op.done);
+        sqe->len = op.len - op.done;
+        sqe->off = op.off + op.done;
+        sqe->buf_index = 0;
+        sqe->user_data = slot;
+    }
+
+    // SQE for an operation on fd; submits first when the ring is full.
+    struct io_uring_sqe *sqe_for(int fd, int fixed) {
+        struct io_uring_sqe *sqe;
+        while (outstanding_ >= URING_ENTRIES || !(sqe = ring_.get_sqe())) reap(1);
+        ++outstanding_;
+        if (fixed >= 0) {
+            sqe->fd = fixed;
+            sqe->flags = IOSQE_FIXED_FILE;
+        } else {
+            sqe->fd = fd;
+        }
+        return sqe;
+    }
+
+    // Submits the queued SQEs, waiting for wait_nr completions if anything
+    // is outstanding, and recycles the slots of the completed writes. A
+    // short write is queued again for its remainder, as pwrite_all() loops;
+    // one that wrote nothing counts as failed.
+    void reap(unsigned int wait_nr) {
+        if (wait_nr && outstanding_ == 0) return;
+        if (wait_nr && free_slots_.empty()) ++waits_;
+        if (ring_.enter(wait_nr) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) perror("io_uring_enter");
+        ++enters_;
+        while (struct io_uring_cqe *cqe = ring_.peek_cqe()) {
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            ring_.cqe_seen();
+            --outstanding_;
+            if (tag != FSYNC_TAG && res > 0) {
+                SlotOp &op = ops_[tag];
+                op.done += static_cast<uint32_t>(res);
+                if (op.done < op.len) {
+                    short_.push_back(static_cast<unsigned int>(tag));
+                    continue;
+                }
+            } else if (res < 0 || tag != FSYNC_TAG) {
+                if (errors_++ == 0) {
+                    std::cerr << "Error: io_uring " << (tag == FSYNC_TAG ? "fsync" : "write") << " failed: "
+                              << (res < 0 ? strerror(-res) : "nothing written") << "\n";
+                }
+            }
+            if (tag != FSYNC_TAG) free_slots_.push_back(static_cast<unsigned int>(tag));
+        }
+        // Requeued after the loop, since queueing may reap again.
+        while (!short_.empty()) {
+            unsigned int slot = short_.back();
+            short_.pop_back();
+            ++resubmits_;
+            queue_write(slot);
+        }
+    }
+
+    Uring ring_;
+    char *buf_ = nullptr; // registered buffer, owned by ring_
+    std::vector<SlotOp> ops_;
+    std::vector<unsigned int> free_slots_;
+    std::vector<unsigned int> short_; // slots to requeue after a short write
+    std::vector<int> free_files_;
+    unsigned int outstanding_ = 0; // SQEs taken, not completed
+    uint64_t writes_ = 0, fsyncs_ = 0, enters_ = 0, waits_ = 0, resubmits_ = 0, errors_ = 0;
+};
+
+struct StreamState {
+    uint32_t expected = 1;
+    uint32_t highest = 0; // highest sequence seen
+    ReorderWindow window;
+    uint64_t given_up = 0; // missing sequences pushed out of the window or beyond the bitmap span
+    bool final_seen = false;
+    uint32_t final_seq = 0;
+    std::chrono::steady_clock::time_point final_at;
+    SeqBitmap arrived;      // -m pwrite/mmap
+    uint64_t received = 0;  // distinct sequences written, -m pwrite/mmap
+    OutputFile out;
+    bool has_file = false;  // out is open (or queued to be)
+    int fixed_file = -1;    // -m uring: index in the fixed file table
+    uint64_t unsynced = 0;  // -m uring -Y: bytes since the last fsync
+    bool opened = false; // output set up (or tried) on the first datagram
+    bool done = false;   // complete, or given up after the timeout
+    uint64_t kernel_drops = 0; // gaps explained by receive buffer overflows
+};
+
+// Receive counters; buffers/syscalls is the achieved batch fill. Without
+// GRO every buffer holds one datagram.
+struct RxStats {
+    uint64_t datagrams = 0;
+    uint64_t buffers = 0;  // recvmmsg slots filled, ring blocks or XSK batches
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+    uint64_t dropped = 0;  // raw frames truncated or with a bad checksum
+    uint32_t kernel_drops = 0; // last SO_RXQ_OVFL count of the socket
+};
+
+// Datagrams the kernel dropped on full UDP receive buffers in this network
+// namespace (Udp6RcvbufErrors), or -1 if unknown. Unlike the per-socket
+// SO_RXQ_OVFL count it leaves out datagrams rejected by socket filters.
+static int64_t udp6_rcvbuf_errors() {
+    std::ifstream in("/proc/net/snmp6");
+    std::string name;
+    int64_t value;
+    while (in >> name >> value) {
+        if (name == "Udp6RcvbufErrors") return value;
+    }
+    return -1;
+}
+
+// Latency from the kernel's receive timestamp to processing, in log2
+// buckets of 8 linear steps each (percentiles within 12.5%).
+struct LatencyStats {
+    static constexpr unsigned int SUB = 8;
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t min_ns = UINT64_MAX, max_ns = 0;
+    uint64_t buckets[64 * SUB] = {};
+
+    void add(uint64_t ns) {
+        count++;
+        sum_ns += ns;
+        min_ns = std::min(min_ns, ns);
+        max_ns = std::max(max_ns, ns);
+        buckets[bucket(ns)]++;
+    }
+
+    void merge(const LatencyStats &o) {
+        count += o.count;
+        sum_ns += o.sum_ns;
+        min_ns = std::min(min_ns, o.min_ns);
+        max_ns = std::max(max_ns, o.max_ns);
+        for (unsigned int k = 0; k < 64 * SUB; ++k) buckets[k] += o.buckets[k];
+    }
+
+    // Lower bound of the bucket holding the p-th percentile.
+    uint64_t percentile(double p) const {
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * double(count - 1)), seen = 0;
+        for (unsigned int k = 0; k < 64 * SUB; ++k) {
+            seen += buckets[k];
+            if (seen > rank) return lower(k);
+        }
+        return max_ns;
+    }
+
+private:
+    static unsigned int bucket(uint64_t ns) {
+        if (ns < SUB) return static_cast<unsigned int>(ns);
+        unsigned int log = 63 - __builtin_clzll(ns); // >= 3
+        return log * SUB + static_cast<unsigned int>((ns >> (log - 3)) & (SUB - 1));
+    }
+    static uint64_t lower(unsigned int k) {
+        if (k < SUB) return k;
+        unsigned int log = k / SUB;
+        return (uint64_t(1) << log) | (uint64_t(k % SUB) << (log - 3));
+    }
+};
+
+// Segment size of a received buffer: the UDP_GRO control message if the
+// kernel coalesced several datagrams, otherwise the whole buffer.
+static size_t gro_segment_size(struct msghdr &mh, size_t len) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg = 0;
+            std::memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            if (seg > 0) return static_cast<size_t>(seg);
+        }
+    }
+    return len;
+}
+
+// Kernel receive time (SO_TIMESTAMPNS, CLOCK_REALTIME) of a buffer in ns,
+// or 0 if there is none.
+static uint64_t rx_timestamp_ns(struct msghdr &mh) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            std::memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+        }
+    }
+    return 0;
+}
+
+// Drop counter of the socket (SO_RXQ_OVFL) when the buffer was queued, or
+// 0 if none is attached (nothing dropped yet).
+static uint32_t rx_overflow_count(struct msghdr &mh) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            std::memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            return drops;
+        }
+    }
+    return 0;
+}
+
+static uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+// Byte count with an optional k/M/G suffix (powers of 1024).
+static uint64_t parse_size(const std::string &s) {
+    size_t used = 0;
+    uint64_t v = std::stoull(s, &used);
+    std::string unit = s.substr(used);
+    if (unit == "k" || unit == "K") v <<= 10;
+    else if (unit == "m" || unit == "M") v <<= 20;
+    else if (unit == "g" || unit == "G") v <<= 30;
+    else if (!unit.empty()) throw std::invalid_argument("bad size unit: " + unit);
+    return v;
+}
+
+static std::set<uint32_t> parse_list(const std::string &s) {
+    std::set<uint32_t> out;
+    if (s.empty()) return out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        try {
+            uint32_t v = static_cast<uint32_t>(std::stoul(item));
+            out.insert(v);
+        } catch (...) {}
+    }
+    return out;
+}
+
+// Reads a subscription spec: "all", a comma list, or @file holding either
+// (ids separated by commas or whitespace; re-read on SIGHUP).
+static bool load_subscriptions(const std::string &spec, bool *all, std::set<uint32_t> *ids) {
+    std::string list = spec;
+    if (!spec.empty() && spec[0] == '@') {
+        std::ifstream in(spec.substr(1));
+        if (!in) return false;
+        std::stringstream ss;
+        ss << in.rdbuf();
+        list = ss.str();
+        for (char &c : list) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = ',';
+        }
+        while (!list.empty() && list.back() == ',') list.pop_back();
+        while (!list.empty() && list.front() == ',') list.erase(0, 1);
+    }
+    *all = (list == "all");
+    ids->clear();
+    if (!*all) *ids = parse_list(list);
+    return true;
+}
+
+// Subscriptions and completed streams of the whole run, shared by the
+// workers. Locked only when a stream completes or subscriptions are
+// reloaded, never per datagram.
+struct RunState {
+    std::mutex lock;
+    bool all = true;
+    std::set<uint32_t> subs;
+    std::set<uint32_t> done;
+
+    // True once every subscribed stream is done; never with -s all.
+    bool complete() {
+        std::lock_guard<std::mutex> g(lock);
+        if (all) return false; // don't auto-exit
+        for (uint32_t sid : subs) {
+            if (!done.count(sid)) return false;
+        }
+        return true;
+    }
+};
+
+// Per-stream reassembly: puts datagrams back in sequence order and writes
+// the payloads to the stream's output file (or stdout), or with -m pwrite
+// writes each one at its offset and tracks which sequences are still missing.
+class Reassembler {
+public:
+    Reassembler(const OutputOptions &out, int timeout, uint32_t window, RunState &run)
+        : out_(out), timeout_(timeout), window_(window), run_(run) {
+        reload();
+        to_stdout_ = !subscribe_all_ && subs_.size() == 1 && out.pattern == "-";
+        if (out_.mode == OutputMode::URING) {
+            uring_.reset(new UringWriter);
+            if (!uring_->init()) {
+                perror("io_uring");
+                std::cerr << "Warning: io_uring unavailable, writing with pwrite\n";
+                uring_.reset();
+                out_.mode = OutputMode::PWRITE;
+            }
+        }
+    }
+
+    // Takes over the run's current subscriptions.
+    void reload() {
+        std::lock_guard<std::mutex> g(run_.lock);
+        subscribe_all_ = run_.all;
+        subs_ = run_.subs;
+    }
+
+    // Handles one datagram (stream header + payload). Returns true once every
+    // subscribed stream has finished. If data lies in the pool slot *slot,
+    // an out-of-order datagram keeps that slot and *slot becomes NO_SLOT;
+    // otherwise it is copied into a slot of its own.
+    bool datagram(const char *data, size_t n, uint32_t *slot = nullptr) {
+        if (n < HDR_LEN) return false;
+
+        uint32_t sid_be = 0, seq_be = 0, flags_be = 0;
+        std::memcpy(&sid_be, data, 4);
+        std::memcpy(&seq_be, data+4, 4);
+        std::memcpy(&flags_be, data+8, 4);
+        uint32_t sid = ntohl(sid_be), seq = ntohl(seq_be), flags = ntohl(flags_be);
+
+        if (!subscribe_all_) {
+            if (subs_.find(sid) == subs_.end()) return false; // not subscribed
+        }
+
+        StreamState &st = stream(sid);
+        if (st.done) return false; // repeated final markers, late packets
+        const char *payload = data + HDR_LEN;
+        size_t len = n - HDR_LEN;
+
+        if (seq > st.highest + 1 && unbooked_drops_ > 0) {
+            uint64_t booked = std::min<uint64_t>(seq - st.highest - 1, unbooked_drops_);
+            st.kernel_drops += booked;
+            unbooked_drops_ -= booked;
+        }
+        st.highest = std::max(st.highest, seq);
+
+        if (seq < st.expected) return false; // duplicate/old
+
+        if (positional()) {
+            if (st.arrived.test(seq)) return false; // duplicate
+            if (st.final_seen && seq > st.final_seq) return false; // trailing final markers
+            if (!st.arrived.fits(seq)) {
+                beyond_span(sid, st, seq);
+                return false;
+            }
+            place(st, seq, payload, len);
+        } else {
+            if (seq - st.expected >= st.window.size()) slide(sid, st, seq - st.window.size() + 1);
+
+            if (seq == st.expected) {
+                write(st, 0, payload, len);
+                st.expected++;
+                drain(st);
+            } else if (!st.window.present(seq)) {
+                // out of order
+                uint32_t keep;
+                if (slot && *slot != PacketPool::NO_SLOT) {
+                    keep = *slot;
+                    *slot = PacketPool::NO_SLOT;
+                } else {
+                    keep = pool_.acquire();
+                    std::memcpy(pool_.data(keep), data, n);
+                }
+                st.window.put(seq, {keep, static_cast<uint32_t>(n)});
+            }
+        }
+
+        if (flags & FLAG_FINAL) {
+            st.final_seen = true;
+            st.final_seq = seq;
+            st.final_at = std::chrono::steady_clock::now();
+            std::cerr << "Final marker seen for stream " << sid << " seq=" << seq << "\n";
+        }
+
+        // If this stream finished, close its file
+        if (st.final_seen && st.expected > st.final_seq) {
+            std::cerr << "Stream " << sid << " finished (expected=" << st.expected << " final=" << st.final_seq;
+            if (st.given_up) std::cerr << ", " << st.given_up << " missing datagrams given up beyond the " << gave_up_beyond();
+            std::cerr << ")\n";
+            close_output(st);
+            mark_done(sid, st);
+            return all_done();
+        }
+        return false;
+    }
+
+    // Gives up on streams whose final marker is older than the timeout, so
+    // the run can end with their files incomplete. Returns true once every
+    // subscribed stream is done.
+    bool check_timeouts() {
+        auto now = std::chrono::steady_clock::now();
+        bool changed = false;
+        for (auto &p : streams_) {
+            StreamState &st = p.second;
+            if (st.final_seen && !st.done && now >= st.final_at + std::chrono::seconds(timeout_)) {
+                size_t missing = positional()
+                                     ? st.final_seq - std::min<uint64_t>(st.received, st.final_seq)
+                                     : st.final_seq - st.expected + 1 - st.window.count() + st.given_up;
+                std::cerr << "Timeout waiting for missing packets for stream " << p.first << " (" << missing << " missing";
+                if (st.given_up) std::cerr << ", " << st.given_up << " of them given up beyond the " << gave_up_beyond();
+                if (st.kernel_drops) std::cerr << ", " << st.kernel_drops << " dropped on a full receive buffer";
+                std::cerr << ")\n";
+                close_output(st);
+                mark_done(p.first, st);
+                changed = true;
+            }
+        }
+        return changed && all_done();
+    }
+
+    // Earliest final-marker timeout still pending, or time_point::max().
+    std::chrono::steady_clock::time_point next_deadline() const {
+        auto next = std::chrono::steady_clock::time_point::max();
+        for (const auto &p : streams_) {
+            const StreamState &st = p.second;
+            if (st.final_seen && !st.done) next = std::min(next, st.final_at + std::chrono::seconds(timeout_));
+        }
+        return next;
+    }
+
+    // Drops newly reported by the socket (SO_RXQ_OVFL). They are booked on
+    // the streams whose next datagrams show a sequence gap, up to the size
+    // of the gap; the rest of a gap counts as network loss.
+    void kernel_drops(uint32_t drops) { unbooked_drops_ += drops; }
+
+    PacketPool &pool() { return pool_; }
+
+    // -A: hands all file writes to writer, which must outlive finish().
+    void set_writer(AsyncWriter *writer) { writer_ = writer; }
+
+    // -m uring: submits the writes queued since the last call.
+    void submit_writes() {
+        if (uring_) uring_->submit();
+    }
+
+    void report_writes(unsigned int index) const {
+        if (uring_) uring_->report(index);
+    }
+
+    bool subscribe_all() const { return subscribe_all_; }
+    const std::set<uint32_t> &subscriptions() const { return subs_; }
+
+    // True once every subscribed stream of the run is done.
+    bool all_done() const { return run_.complete(); }
+
+    // Flushes what is still buffered in order and closes the files.
+    void finish() {
+        for (auto &p : streams_) {
+            StreamState &st = p.second;
+            if (out_.mode == OutputMode::STREAM) drain(st);
+            close_output(st);
+        }
+        if (uring_) uring_->wait_all();
+    }
+
+    // Prints the per-stream receive buffer drops.
+    void report_kernel_drops() const {
+        for (const auto &p : streams_) {
+            if (!p.second.kernel_drops) continue;
+            std::cerr << "  stream " << p.first << ": " << p.second.kernel_drops << " datagrams dropped on a full receive buffer\n";
+        }
+    }
+
+private:
+    void mark_done(uint32_t sid, StreamState &st) {
+        st.done = true;
+        std::lock_guard<std::mutex> g(run_.lock);
+        run_.done.insert(sid);
+    }
+
+    // Returns the stream's state, opening its output on first use.
+    StreamState &stream(uint32_t sid) {
+        StreamState &st = streams_[sid];
+        if (st.opened) return st;
+        st.opened = true;
+        if (out_.mode == OutputMode::STREAM) st.window.reset(window_);
+        if (!to_stdout_) {
+            // create filename from pattern
+            std::string fname = out_.pattern;
+            size_t pos = fname.find("{id}");
+            if (pos != std::string::npos) {
+                fname.replace(pos, 4, std::to_string(sid));
+            }
+            if (!st.out.open(fname, out_)) {
+                std::cerr << "Error: cannot open output file: " << fname << " for stream " << sid << "\n";
+            } else {
+                st.has_file = true;
+                if (uring_) st.fixed_file = uring_->add_file(st.out.fd());
+                std::cerr << "Opened output file " << fname << " for stream " << sid << "\n";
+            }
+        } else {
+            st.out.open_stdout();
+            st.has_file = true;
+            std::cerr << "Streaming stream " << sid << " to stdout\n";
+        }
+        return st;
+    }
+
+    // Writes n bytes at offset off of the stream (appended in stream mode),
+    // or queues them for the writer thread or io_uring.
+    void write(StreamState &st, uint64_t off, const char *p, size_t n) {
+        if (!st.has_file || n == 0) return;
+        if (uring_) {
+            uring_->write(st.out.fd(), st.fixed_file, off, p, n);
+            if (out_.sync_every && (st.unsynced += n) >= out_.sync_every) {
+                uring_->fsync(st.out.fd(), st.fixed_file);
+                st.unsynced = 0;
+            }
+        } else if (writer_) {
+            writer_->write(&st.out, off, p, n);
+        } else {
+            st.out.write(off, p, n);
+        }
+    }
+
+    bool positional() const { return out_.mode != OutputMode::STREAM; }
+
+    void close_output(StreamState &st) {
+        if (!st.has_file) return;
+        if (uring_) {
+            uring_->remove_file(st.out.fd(), st.fixed_file, out_.sync_every > 0);
+            st.fixed_file = -1;
+        }
+        if (writer_) writer_->close(&st.out);
+        else st.out.close();
+        st.has_file = false;
+    }
+
+    // -m pwrite/mmap: writes the payload at the offset of its sequence and
+    // marks it arrived; expected becomes the lowest sequence still missing.
+    void place(StreamState &st, uint32_t seq, const char *p, size_t n) {
+        write(st, uint64_t(seq - 1) * PAYLOAD_SIZE, p, n);
+        st.arrived.set(seq);
+        st.received++;
+        if (seq == st.expected) {
+            st.expected = st.arrived.first_clear(seq);
+            st.arrived.trim(st.expected);
+        }
+    }
+
+    // Writes the buffered datagram of st.expected and frees its slot.
+    void deliver(StreamState &st) {
+        ReorderWindow::Entry e = st.window.take(st.expected);
+        write(st, 0, pool_.data(e.slot) + HDR_LEN, e.len - HDR_LEN);
+        pool_.release(e.slot);
+    }
+
+    // Writes buffered packets that are now in order.
+    void drain(StreamState &st) {
+        for (uint32_t n = st.window.run(st.expected); n > 0; --n) {
+            deliver(st);
+            st.expected++;
+        }
+    }
+
+    // -m pwrite/mmap: drops a datagram too far beyond the oldest gap for the
+    // bitmap instead of growing the bitmap for it; it stays missing and is
+    // counted as given up.
+    void beyond_span(uint32_t sid, StreamState &st, uint32_t seq) {
+        if (st.given_up++ == 0) {
+            std::cerr << "Warning: stream " << sid << " seq=" << seq << " lies more than " << SeqBitmap::MAX_SPAN
+                      << " datagrams beyond the oldest gap, dropped (further ones are counted)\n";
+        }
+    }
+
+    // What datagrams counted in given_up fell beyond, for the messages.
+    const char *gave_up_beyond() const { return positional() ? "bitmap span" : "reorder window"; }
+
+    // A datagram arrived at or beyond expected + window: moves the window
+    // up to new_base, writing what arrived below it and giving up on the
+    // rest, so a long loss burst costs data instead of unbounded memory.
+    // Only the window itself is walked (and only while it holds datagrams),
+    // so a far-ahead or corrupt seq costs at most one window, not one step
+    // per skipped sequence.
+    void slide(uint32_t sid, StreamState &st, uint32_t new_base) {
+        uint64_t before = st.given_up;
+        uint32_t stop = new_base - st.expected > st.window.size() ? st.expected + st.window.size() : new_base;
+        for (; st.expected != stop && st.window.count() > 0; st.expected++) {
+            if (st.window.present(st.expected)) deliver(st);
+            else st.given_up++;
+        }
+        st.given_up += new_base - st.expected;
+        st.expected = new_base;
+        drain(st);
+        if (before == 0) {
+            std::cerr << "Warning: stream " << sid << " is more than " << st.window.size() << " datagrams ahead of a gap, giving up "
+                      << st.given_up << " missing datagram(s) (further ones are counted)\n";
+        }
+    }
+
+    OutputOptions out_;
+    int timeout_;
+    uint32_t window_;
+    RunState &run_;
+    bool subscribe_all_ = true;
+    std::set<uint32_t> subs_; // copy of run_.subs for the per-datagram check
+    bool to_stdout_ = false;
+    std::map<uint32_t, StreamState> streams_;
+    uint64_t unbooked_drops_ = 0;
+    PacketPool pool_;
+    AsyncWriter *writer_ = nullptr;
+    std::unique_ptr<UringWriter> uring_;
+};
+
+// recvmmsg() packet array. Without GRO datagram k lands in pool slot
+// slots[k], which the reassembler may keep for reordering; receive_ready
+// then puts a fresh slot in its place. With GRO a buffer must hold a whole
+// coalesced run, so buffer k lands in data[k*GRO_BUF_SIZE] instead.
+struct RxBatch {
+    unsigned int size;
+    bool gro;
+    bool stamps; // SO_TIMESTAMPNS for the latency measurement
+    size_t ctrl_len;
+    std::vector<char> data;
+    std::vector<char> ctrl; // SO_RXQ_OVFL, UDP_GRO and timestamp cmsgs per slot
+    std::vector<uint32_t> slots;
+    std::vector<struct iovec> iov;
+    std::vector<struct mmsghdr> msgs;
+
+    RxBatch(unsigned int size, bool gro, bool stamps)
+        : size(size), gro(gro), stamps(stamps),
+          ctrl_len(CMSG_SPACE(sizeof(uint32_t)) + (gro ? CMSG_SPACE(sizeof(int)) : 0) +
+                   (stamps ? CMSG_SPACE(sizeof(struct timespec)) : 0)),
+          data(gro ? size * GRO_BUF_SIZE : 0), ctrl(size * ctrl_len), slots(size, PacketPool::NO_SLOT), iov(size), msgs(size) {
+        for (unsigned int k = 0; k < size; ++k) {
+            iov[k].iov_base = gro ? data.data() + k * GRO_BUF_SIZE : nullptr;
+            iov[k].iov_len = gro ? GRO_BUF_SIZE : MAX_PKT;
+            std::memset(&msgs[k], 0, sizeof(msgs[k]));
+            msgs[k].msg_hdr.msg_iov = &iov[k];
+            msgs[k].msg_hdr.msg_iovlen = 1;
+        }
+    }
+};
+
+// Drains the non-blocking socket batch by batch into the reassembler.
+// Returns 1 once every subscribed stream is done, -1 on a socket error and
+// 0 when the socket is empty. New SO_RXQ_OVFL drops are booked per stream
+// only if book_drops: datagrams a socket filter rejects count there too.
+static int receive_ready(int sock, RxBatch &b, Reassembler &rx, RxStats &stats, LatencyStats &latency, bool book_drops) {
+    while (true) {
+        for (unsigned int k = 0; k < b.size; ++k) {
+            b.msgs[k].msg_hdr.msg_control = b.ctrl.data() + k * b.ctrl_len;
+            b.msgs[k].msg_hdr.msg_controllen = b.ctrl_len;
+            if (!b.gro && b.slots[k] == PacketPool::NO_SLOT) {
+                b.slots[k] = rx.pool().acquire();
+                b.iov[k].iov_base = rx.pool().data(b.slots[k]);
+            }
+        }
+        int r = recvmmsg(sock, b.msgs.data(), b.size, 0, nullptr);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EWOULDBLOCK || errno == EAGAIN) return 0;
+            perror("recvmmsg");
+            return -1;
+        }
+        stats.syscalls++;
+        if (b.stamps) {
+            uint64_t now = realtime_ns();
+            for (int k = 0; k < r; ++k) {
+                uint64_t ts = rx_timestamp_ns(b.msgs[k].msg_hdr);
+                if (ts) latency.add(now > ts ? now - ts : 0);
+            }
+        }
+        for (int k = 0; k < r; ++k) {
+            const char *data = static_cast<const char*>(b.iov[k].iov_base);
+            size_t len = b.msgs[k].msg_len;
+            size_t seg = b.gro ? gro_segment_size(b.msgs[k].msg_hdr, len) : len;
+            stats.buffers++;
+            stats.bytes += len;
+            uint32_t drops = rx_overflow_count(b.msgs[k].msg_hdr);
+            if (drops != stats.kernel_drops) {
+                if (book_drops) rx.kernel_drops(drops - stats.kernel_drops);
+                stats.kernel_drops = drops;
+            }
+            if (!b.gro) {
+                stats.datagrams++;
+                if (rx.datagram(data, len, &b.slots[k])) return 1;
+                continue;
+            }
+            // Walk the datagrams of a coalesced buffer; only the last may be short.
+            for (size_t off = 0; off < len; off += seg) {
+                stats.datagrams++;
+                if (rx.datagram(data + off, std::min(seg, len - off))) return 1;
+            }
+        }
+        if (static_cast<unsigned int>(r) < b.size) return 0; // queue drained
+    }
+}
+
+// Appends the stream_id part of a classic BPF socket filter, with the
+// stream_id at byte sid_off of the packet: passes it only if the id is in
+// subs (any, if subs is null) and, with several workers, if
+// stream_id % workers == index.
+static void append_stream_match(std::vector<struct sock_filter> &code, uint32_t sid_off, unsigned int workers,
+                                unsigned int index, const std::set<uint32_t> *subs) {
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sid_off));
+    if (subs) {
+        // A miss falls through to the next id; a hit jumps past the list and
+        // the reject (JA has a 32-bit offset, jt/jf only 8 bits).
+        size_t left = subs->size();
+        for (uint32_t sid : *subs) {
+            --left;
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, sid, 0, 1));
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JA, static_cast<uint32_t>(2 * left + 1), 0, 0));
+        }
+        code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    }
+    if (workers > 1) {
+        code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers));
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, index, 1, 0));
+        code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+}
+
+// Attaches code as the socket filter, atomically replacing the previous one.
+static bool attach_filter(int sock, std::vector<struct sock_filter> &code) {
+    struct sock_fprog prog{};
+    prog.len = static_cast<unsigned short>(code.size());
+    prog.filter = code.data();
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt(SO_ATTACH_FILTER)");
+        return false;
+    }
+    return true;
+}
+
+// Socket filter for one worker's UDP socket. It runs on the datagram
+// (offset 0 = UDP header, stream_id at 8). Multicast is copied to every
+// socket of a reuseport group rather than load-balanced, so the steering
+// between workers has to happen in each socket's own filter.
+static bool attach_stream_filter(int sock, unsigned int workers, unsigned int index, const std::set<uint32_t> *subs,
+                                 bool *filtered) {
+    *filtered = subs || workers > 1;
+    if (!*filtered) {
+        int unused = 0;
+        if (setsockopt(sock, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) < 0 && errno != ENOENT) {
+            perror("setsockopt(SO_DETACH_FILTER)");
+            return false;
+        }
+        return true;
+    }
+    std::vector<struct sock_filter> code;
+    append_stream_match(code, 8, workers, index, subs);
+    return attach_filter(sock, code);
+}
+
+// Opens a non-blocking receive socket on port and joins the group. On
+// failure returns -1 with the exit code in *rc.
+static int open_socket(int port, const struct ipv6_mreq &mreq, bool *gro, int *rc) {
+    int sock = ::socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sock < 0) { perror("socket"); *rc = 2; return -1; }
 
-struct StreamState {
-    uint32_t expected = 1;
-    std::map<uint32_t, std::vector<char>> buffer;
-    bool final_seen = false;
-    uint32_t final_seq = 0;
-    std::chrono::steady_clock::time_point final_at;
-    std::ofstream fout;
-    bool has_file = false;
+    int reuse = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        perror("setsockopt(SO_REUSEADDR)");
+    }
+#ifdef SO_REUSEPORT
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+    }
+#endif
+
+    struct sockaddr_in6 local{};
+    local.sin6_family = AF_INET6;
+    local.sin6_addr = in6addr_any;
+    local.sin6_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) < 0) { perror("bind"); close(sock); *rc = 3; return -1; }
+
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+        perror("setsockopt(IPV6_JOIN_GROUP)");
+        close(sock);
+        *rc = 5;
+        return -1;
+    }
+
+    int one = 1;
+    if (*gro && setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+        perror("setsockopt(UDP_GRO)");
+        std::cerr << "Warning: UDP GRO unavailable, receiving single datagrams\n";
+        *gro = false;
+    }
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0) {
+        perror("fcntl(O_NONBLOCK)");
+        close(sock);
+        *rc = 2;
+        return -1;
+    }
+    return sock;
+}
+
+// Unfolded sum of the IPv6 pseudo header for a UDP length of len.
+static uint32_t udp6_pseudo_sum(const unsigned char *ip6, size_t len) {
+    uint32_t sum = 0;
+    for (size_t k = 8; k < 40; k += 2) sum += (ip6[k] << 8) | ip6[k + 1]; // source + destination
+    sum += static_cast<uint32_t>(len >> 16) + static_cast<uint32_t>(len & 0xffff);
+    sum += IPPROTO_UDP;
+    return sum;
+}
+
+// True if the checksum field only holds the pseudo header sum, as left by
+// checksum offload (CHECKSUM_PARTIAL) on a frame from a local sender, e.g.
+// over veth. Such a frame never crossed a wire.
+static bool udp6_checksum_partial(const unsigned char *ip6, const unsigned char *udp, size_t len) {
+    uint32_t sum = udp6_pseudo_sum(ip6, len);
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<uint32_t>((udp[6] << 8) | udp[7]) == sum;
+}
+
+// Lets reads on sock poll the device queue for up to usec before giving
+// up, and asks the kernel to leave the queue to us instead of its softirq
+// (SO_PREFER_BUSY_POLL). Raising either above the sysctl defaults needs
+// CAP_NET_ADMIN; failures are reported and receiving goes on without.
+static void enable_busy_poll(int sock, int usec, int budget) {
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) perror("setsockopt(SO_BUSY_POLL)");
+    if (setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0) perror("setsockopt(SO_PREFER_BUSY_POLL)");
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) < 0) perror("setsockopt(SO_BUSY_POLL_BUDGET)");
+}
+
+// Sets the receive buffer to bytes, beyond net.core.rmem_max if allowed
+// (SO_RCVBUFFORCE needs CAP_NET_ADMIN), and turns on the SO_RXQ_OVFL drop
+// counter. Returns the usable size granted; the kernel doubles the request
+// for its bookkeeping and reports the doubled value.
+static int size_rcvbuf(int sock, int bytes) {
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0 &&
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) perror("setsockopt(SO_RXQ_OVFL)");
+    int granted = 0;
+    socklen_t len = sizeof(granted);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &granted, &len) < 0) perror("getsockopt(SO_RCVBUF)");
+    return granted / 2;
+}
+
+// UDP checksum over the IPv6 pseudo header; udp points at the UDP header
+// of len bytes, ip6 at the IPv6 header. Returns true if it verifies.
+static bool udp6_checksum_ok(const unsigned char *ip6, const unsigned char *udp, size_t len) {
+    uint32_t sum = udp6_pseudo_sum(ip6, len);
+    for (size_t k = 0; k + 1 < len; k += 2) sum += (udp[k] << 8) | udp[k + 1];
+    if (len & 1) sum += udp[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return sum == 0xffff;
+}
+
+// Hands the datagrams of an Ethernet/IPv6/UDP frame of caplen bytes to rx,
+// checking the UDP checksum unless csum_done. Returns true once the run is
+// complete.
+static bool frame_to_rx(const unsigned char *eth, size_t caplen, bool csum_done, Reassembler &rx, RxStats &stats) {
+    if (caplen < L2L4_LEN) {
+        stats.dropped++;
+        return false;
+    }
+    const unsigned char *ip6 = eth + ETH_LEN;
+    const unsigned char *udp = ip6 + IP6_LEN;
+    // Trust the IPv6 length over the capture length, which may include padding.
+    size_t len = std::min<size_t>(caplen - ETH_LEN - IP6_LEN, (ip6[4] << 8) | ip6[5]);
+    if (len < UDP_LEN) return false;
+    if (!csum_done && !udp6_checksum_ok(ip6, udp, len) && !udp6_checksum_partial(ip6, udp, len)) {
+        stats.dropped++;
+        return false;
+    }
+    // A GRO/GSO frame carries a run of our datagrams of MAX_PKT each.
+    const char *data = reinterpret_cast<const char*>(udp + UDP_LEN);
+    size_t payload = len - UDP_LEN;
+    stats.bytes += payload;
+    for (size_t off = 0; off < payload; off += MAX_PKT) {
+        stats.datagrams++;
+        if (rx.datagram(data + off, std::min(MAX_PKT, payload - off))) return true;
+    }
+    return false;
+}
+
+// AF_PACKET receive ring (TPACKET_V3). The kernel fills blocks of frames
+// in a mapping shared with us and hands over whole blocks, so a busy
+// receiver makes no per-packet syscalls; frames are parsed straight out of
+// the ring. The socket filter passes only IPv6/UDP frames to our group and
+// port (and subscribed stream_ids).
+class PacketRing {
+public:
+    static constexpr unsigned int RING_BLOCK_SIZE = 1 << 20;
+    static constexpr unsigned int RING_BLOCK_NR = 16;
+    static constexpr unsigned int RING_FRAME_SIZE = 2048; // sizing hint only in V3
+    static constexpr unsigned int RETIRE_TOV_MS = 4;      // hand over partly filled blocks
+
+    ~PacketRing() {
+        if (map_ && map_ != MAP_FAILED) munmap(map_, size_t(RING_BLOCK_SIZE) * RING_BLOCK_NR);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool open(unsigned int ifindex, const struct in6_addr &group, int port, const std::set<uint32_t> *subs) {
+        group_ = group;
+        port_ = port;
+        // Protocol 0: no frames are queued before the filter and ring are up.
+        fd_ = ::socket(AF_PACKET, SOCK_RAW, 0);
+        if (fd_ < 0) { perror("socket(AF_PACKET)"); return false; }
+        int version = TPACKET_V3;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            perror("setsockopt(PACKET_VERSION)");
+            return false;
+        }
+        if (!set_filter(subs)) return false;
+
+        struct tpacket_req3 req{};
+        req.tp_block_size = RING_BLOCK_SIZE;
+        req.tp_block_nr = RING_BLOCK_NR;
+        req.tp_frame_size = RING_FRAME_SIZE;
+        req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_NR;
+        req.tp_retire_blk_tov = RETIRE_TOV_MS;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            perror("setsockopt(PACKET_RX_RING)");
+            return false;
+        }
+        map_ = mmap(nullptr, size_t(RING_BLOCK_SIZE) * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd_, 0);
+        if (map_ == MAP_FAILED) {
+            // MAP_LOCKED needs RLIMIT_MEMLOCK headroom; the ring works without it.
+            map_ = mmap(nullptr, size_t(RING_BLOCK_SIZE) * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, 0);
+        }
+        if (map_ == MAP_FAILED) { perror("mmap(PACKET_RX_RING)"); return false; }
+
+        struct sockaddr_ll ll{};
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_IPV6);
+        ll.sll_ifindex = static_cast<int>(ifindex);
+        if (bind(fd_, (struct sockaddr*)&ll, sizeof(ll)) < 0) { perror("bind(AF_PACKET)"); return false; }
+        return true;
+    }
+
+    int fd() const { return fd_; }
+
+    // Filter on the Ethernet frame: IPv6, next header UDP (no extension
+    // headers), our group and destination port, then the stream_id at the
+    // start of the UDP payload.
+    bool set_filter(const std::set<uint32_t> *subs) {
+        std::vector<struct sock_filter> code;
+        auto require = [&code](uint16_t size, uint32_t off, uint32_t value) {
+            code.push_back(BPF_STMT(BPF_LD | size | BPF_ABS, off));
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, value, 1, 0));
+            code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+        };
+        require(BPF_H, 12, ETH_P_IPV6);
+        require(BPF_B, ETH_LEN + 6, IPPROTO_UDP);
+        for (uint32_t k = 0; k < 4; ++k) {
+            uint32_t word;
+            std::memcpy(&word, group_.s6_addr + 4 * k, 4);
+            require(BPF_W, ETH_LEN + 24 + 4 * k, ntohl(word));
+        }
+        require(BPF_H, ETH_LEN + IP6_LEN + 2, static_cast<uint32_t>(port_));
+        append_stream_match(code, L2L4_LEN, 1, 0, subs);
+        return attach_filter(fd_, code);
+    }
+
+    // Hands the frames of every block the kernel has released to rx and
+    // gives the blocks back. Returns 1 once the run is complete, else 0.
+    int receive(Reassembler &rx, RxStats &stats) {
+        while (true) {
+            auto *block = reinterpret_cast<struct tpacket_block_desc*>(
+                static_cast<char*>(map_) + size_t(cur_) * RING_BLOCK_SIZE);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) return 0;
+            stats.buffers++;
+            bool done = false;
+            auto *frame = reinterpret_cast<struct tpacket3_hdr*>(
+                reinterpret_cast<char*>(block) + block->hdr.bh1.offset_to_first_pkt);
+            for (uint32_t k = 0; k < block->hdr.bh1.num_pkts && !done; ++k) {
+                done = frame_to(rx, stats, frame);
+                frame = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<char*>(frame) + frame->tp_next_offset);
+            }
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            cur_ = (cur_ + 1) % RING_BLOCK_NR;
+            if (done) return 1;
+        }
+    }
+
+private:
+    bool frame_to(Reassembler &rx, RxStats &stats, const struct tpacket3_hdr *frame) {
+        if (frame->tp_len > frame->tp_snaplen) {
+            stats.dropped++; // truncated to the ring frame
+            return false;
+        }
+        // Nothing has checked the checksum yet, unless the driver did
+        // (CSUM_VALID) or the frame is local (CSUMNOTREADY).
+        bool csum_done = frame->tp_status & (TP_STATUS_CSUMNOTREADY | TP_STATUS_CSUM_VALID);
+        return frame_to_rx(reinterpret_cast<const unsigned char*>(frame) + frame->tp_mac, frame->tp_snaplen,
+                           csum_done, rx, stats);
+    }
+
+    int fd_ = -1;
+    void *map_ = nullptr;
+    unsigned int cur_ = 0;
+    struct in6_addr group_{};
+    int port_ = 0;
 };
 
-static std::set<uint32_t> parse_list(const std::string &s) {
-    std::set<uint32_t> out;
-    if (s.empty()) return out;
-    std::stringstream ss(s);
-    std::string item;
-    while (std::getline(ss, item, ',')) {
-        try {
-            uint32_t v = static_cast<uint32_t>(std::stoul(item));
-            out.insert(v);
-        } catch (...) {}
+// bpf() without libbpf.
+static int sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+    return static_cast<int>(syscall(__NR_bpf, cmd, attr, sizeof(*attr)));
+}
+
+static struct bpf_insn ebpf_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn in{};
+    in.code = code;
+    in.dst_reg = dst & 0xf;
+    in.src_reg = src & 0xf;
+    in.off = off;
+    in.imm = imm;
+    return in;
+}
+
+// XDP program on the interface that redirects our frames (IPv6/UDP to the
+// group and port, subscribed stream_ids only) into the AF_XDP socket of the
+// receiving queue via an XSKMAP; everything else goes on to the stack. The
+// program is assembled here and attached through a bpf link, so it is
+// detached again when the process exits.
+class XdpProgram {
+public:
+    ~XdpProgram() {
+        for (int fd : {link_, prog_, map_}) {
+            if (fd >= 0) close(fd);
+        }
     }
-    return out;
+
+    // mode: "native" (driver), "generic" (skb, works on any device such as
+    // veth) or "auto" (native if the driver supports it).
+    bool open(unsigned int ifindex, unsigned int queues, const struct in6_addr &group, int port,
+              const std::set<uint32_t> *subs, const std::string &mode) {
+        group_ = group;
+        port_ = port;
+        union bpf_attr attr{};
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(int);
+        attr.max_entries = queues;
+        map_ = sys_bpf(BPF_MAP_CREATE, &attr);
+        if (map_ < 0) { perror("bpf(BPF_MAP_CREATE)"); return false; }
+        prog_ = load(subs);
+        if (prog_ < 0) return false;
+
+        for (uint32_t flags : {uint32_t(XDP_FLAGS_DRV_MODE), uint32_t(XDP_FLAGS_SKB_MODE)}) {
+            if ((mode == "generic" && flags == XDP_FLAGS_DRV_MODE) || (mode == "native" && flags == XDP_FLAGS_SKB_MODE)) continue;
+            attr = {};
+            attr.link_create.prog_fd = prog_;
+            attr.link_create.target_ifindex = ifindex;
+            attr.link_create.attach_type = BPF_XDP;
+            attr.link_create.flags = flags;
+            link_ = sys_bpf(BPF_LINK_CREATE, &attr);
+            if (link_ >= 0) {
+                native_ = (flags == XDP_FLAGS_DRV_MODE);
+                return true;
+            }
+        }
+        perror("bpf(BPF_LINK_CREATE)");
+        return false;
+    }
+
+    bool native() const { return native_; }
+
+    // Frames arriving on queue go to sock from now on.
+    bool add_socket(uint32_t queue, int sock) {
+        union bpf_attr attr{};
+        attr.map_fd = map_;
+        attr.key = reinterpret_cast<uint64_t>(&queue);
+        attr.value = reinterpret_cast<uint64_t>(&sock);
+        attr.flags = BPF_ANY;
+        if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) { perror("bpf(BPF_MAP_UPDATE_ELEM)"); return false; }
+        return true;
+    }
+
+    // Swaps in a program for new subscriptions (any stream, if subs is null).
+    bool update(const std::set<uint32_t> *subs) {
+        int prog = load(subs);
+        if (prog < 0) return false;
+        union bpf_attr attr{};
+        attr.link_update.link_fd = link_;
+        attr.link_update.new_prog_fd = prog;
+        if (sys_bpf(BPF_LINK_UPDATE, &attr) < 0) {
+            perror("bpf(BPF_LINK_UPDATE)");
+            close(prog);
+            return false;
+        }
+        close(prog_);
+        prog_ = prog;
+        return true;
+    }
+
+private:
+    // Same checks as PacketRing's socket filter, in eBPF: r2 = data, r3 =
+    // data_end, r5 = the field under test, r6 = ctx. Packet words are
+    // compared in network byte order (32-bit jumps, so no sign extension).
+    int load(const std::set<uint32_t> *subs) {
+        std::vector<struct bpf_insn> code;
+        std::vector<size_t> to_pass, to_redirect;
+        auto jump = [&code](std::vector<size_t> &fixups, struct bpf_insn in) {
+            fixups.push_back(code.size());
+            code.push_back(in);
+        };
+        auto require = [&](uint8_t size, size_t off, uint32_t value) {
+            code.push_back(ebpf_insn(BPF_LDX | BPF_MEM | size, 5, 2, static_cast<int16_t>(off), 0));
+            jump(to_pass, ebpf_insn(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, 0, static_cast<int32_t>(value)));
+        };
+        code.push_back(ebpf_insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+        code.push_back(ebpf_insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, data), 0));
+        code.push_back(ebpf_insn(BPF_LDX | BPF_MEM | BPF_W, 3, 6, offsetof(struct xdp_md, data_end), 0));
+        code.push_back(ebpf_insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+        code.push_back(ebpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, L2L4_LEN + 4)); // through the stream_id
+        jump(to_pass, ebpf_insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0));
+        require(BPF_H, 12, htons(ETH_P_IPV6));
+        require(BPF_B, ETH_LEN + 6, IPPROTO_UDP);
+        for (uint32_t k = 0; k < 4; ++k) {
+            uint32_t word;
+            std::memcpy(&word, group_.s6_addr + 4 * k, 4);
+            require(BPF_W, ETH_LEN + 24 + 4 * k, word);
+        }
+        require(BPF_H, ETH_LEN + IP6_LEN + 2, htons(static_cast<uint16_t>(port_)));
+        if (subs) {
+            code.push_back(ebpf_insn(BPF_LDX | BPF_MEM | BPF_W, 5, 2, L2L4_LEN, 0));
+            for (uint32_t sid : *subs) jump(to_redirect, ebpf_insn(BPF_JMP32 | BPF_JEQ | BPF_K, 5, 0, 0, static_cast<int32_t>(htonl(sid))));
+            jump(to_pass, ebpf_insn(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+        }
+        // bpf_redirect_map(xskmap, rx_queue_index, XDP_PASS): no socket on
+        // that queue means the frame goes to the stack.
+        size_t redirect = code.size();
+        code.push_back(ebpf_insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0));
+        code.push_back(ebpf_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_));
+        code.push_back(ebpf_insn(0, 0, 0, 0, 0));
+        code.push_back(ebpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS));
+        code.push_back(ebpf_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+        code.push_back(ebpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+        size_t pass = code.size();
+        code.push_back(ebpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS));
+        code.push_back(ebpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+        for (size_t i : to_pass) code[i].off = static_cast<int16_t>(pass - i - 1);
+        for (size_t i : to_redirect) code[i].off = static_cast<int16_t>(redirect - i - 1);
+
+        static const char license[] = "GPL";
+        union bpf_attr attr{};
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.expected_attach_type = BPF_XDP;
+        attr.insns = reinterpret_cast<uint64_t>(code.data());
+        attr.insn_cnt = static_cast<uint32_t>(code.size());
+        attr.license = reinterpret_cast<uint64_t>(license);
+        int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+        if (fd < 0) {
+            perror("bpf(BPF_PROG_LOAD)");
+            // Load again for the verifier's explanation.
+            std::vector<char> log(1 << 16);
+            attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+            attr.log_size = static_cast<uint32_t>(log.size());
+            attr.log_level = 1;
+            if (sys_bpf(BPF_PROG_LOAD, &attr) < 0) std::cerr << log.data() << "\n";
+        }
+        return fd;
+    }
+
+    int map_ = -1, prog_ = -1, link_ = -1;
+    bool native_ = false;
+    struct in6_addr group_{};
+    int port_ = 0;
+};
+
+// AF_XDP receive socket for one queue. Every UMEM frame starts out on the
+// fill ring; the kernel puts the redirected frames on the RX ring, their
+// datagrams are reassembled straight out of UMEM and the frame goes back
+// on the fill ring. Binds zero-copy when the program runs in native mode
+// and the driver allows it, otherwise copy mode (veth, generic XDP).
+class XdpRx {
+public:
+    ~XdpRx() {
+        if (fd_ >= 0) close(fd_);
+        if (umem_) munmap(umem_, size_t(UMEM_FRAMES) * UMEM_FRAME_SIZE);
+    }
+
+    bool open(unsigned int ifindex, uint32_t queue, bool try_zerocopy) {
+        fd_ = ::socket(AF_XDP, SOCK_RAW, 0);
+        if (fd_ < 0) { perror("socket(AF_XDP)"); return false; }
+
+        size_t umem_len = size_t(UMEM_FRAMES) * UMEM_FRAME_SIZE;
+        void *p = mmap(nullptr, umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED) { perror("mmap(UMEM)"); return false; }
+        umem_ = static_cast<unsigned char*>(p);
+        struct xdp_umem_reg mr{};
+        mr.addr = reinterpret_cast<uint64_t>(umem_);
+        mr.len = umem_len;
+        mr.chunk_size = UMEM_FRAME_SIZE;
+        if (setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0) { perror("setsockopt(XDP_UMEM_REG)"); return false; }
+
+        // The completion ring is unused for receive but must exist for bind().
+        int comp_n = 64, ring_n = UMEM_FRAMES;
+        if (setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING, &ring_n, sizeof(ring_n)) < 0 ||
+            setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp_n, sizeof(comp_n)) < 0 ||
+            setsockopt(fd_, SOL_XDP, XDP_RX_RING, &ring_n, sizeof(ring_n)) < 0) {
+            perror("setsockopt(AF_XDP rings)");
+            return false;
+        }
+        struct xdp_mmap_offsets off{};
+        socklen_t optlen = sizeof(off);
+        if (getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) { perror("getsockopt(XDP_MMAP_OFFSETS)"); return false; }
+        if (!fill_.map(fd_, off.fr, ring_n, XDP_UMEM_PGOFF_FILL_RING) ||
+            !comp_.map(fd_, off.cr, comp_n, XDP_UMEM_PGOFF_COMPLETION_RING) ||
+            !rx_.map(fd_, off.rx, ring_n, XDP_PGOFF_RX_RING)) {
+            return false;
+        }
+
+        fill_prod_ = *fill_.producer;
+        for (uint32_t i = 0; i < UMEM_FRAMES; ++i) fill_.ring[fill_prod_++ & fill_.mask] = uint64_t(i) * UMEM_FRAME_SIZE;
+        __atomic_store_n(fill_.producer, fill_prod_, __ATOMIC_RELEASE);
+
+        struct sockaddr_xdp sxdp{};
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = ifindex;
+        sxdp.sxdp_queue_id = queue;
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+        if (!try_zerocopy || bind(fd_, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) {
+            sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+            if (bind(fd_, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) { perror("bind(AF_XDP)"); return false; }
+        } else {
+            zerocopy_ = true;
+        }
+        return true;
+    }
+
+    int fd() const { return fd_; }
+    bool zerocopy() const { return zerocopy_; }
+
+    // Reassembles every frame on the RX ring and refills the fill ring.
+    // Returns 1 once the run is complete, else 0.
+    int receive(Reassembler &rx, RxStats &stats) {
+        while (true) {
+            uint32_t cons = *rx_.consumer;
+            uint32_t prod = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+            if (cons == prod) return 0;
+            stats.buffers++;
+            bool done = false;
+            for (; cons != prod && !done; ++cons) {
+                const struct xdp_desc &d = rx_.ring[cons & rx_.mask];
+                // XDP frames carry no checksum status (CSUMNOTREADY), so
+                // always verify; local frames are recognised by their sum.
+                done = frame_to_rx(umem_ + d.addr, d.len, false, rx, stats);
+                fill_.ring[fill_prod_++ & fill_.mask] = d.addr & ~uint64_t(UMEM_FRAME_SIZE - 1);
+            }
+            __atomic_store_n(rx_.consumer, cons, __ATOMIC_RELEASE);
+            __atomic_store_n(fill_.producer, fill_prod_, __ATOMIC_RELEASE);
+            if (__atomic_load_n(fill_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+                stats.syscalls++;
+                recvfrom(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+            }
+            if (done) return 1;
+        }
+    }
+
+    // Kernel-side drops of this socket: RX ring full, fill ring empty.
+    void report(uint32_t queue) const {
+        struct xdp_statistics xs{};
+        socklen_t optlen = sizeof(xs);
+        if (getsockopt(fd_, SOL_XDP, XDP_STATISTICS, &xs, &optlen) < 0) { perror("getsockopt(XDP_STATISTICS)"); return; }
+        if (xs.rx_dropped || xs.rx_ring_full || xs.rx_fill_ring_empty_descs || xs.rx_invalid_descs) {
+            std::cerr << "  queue " << queue << ": " << xs.rx_dropped << " dropped, " << xs.rx_ring_full << " RX ring full, "
+                      << xs.rx_fill_ring_empty_descs << " fill ring empty, " << xs.rx_invalid_descs << " invalid\n";
+        }
+    }
+
+private:
+    static constexpr uint32_t UMEM_FRAMES = 4096;
+    static constexpr uint32_t UMEM_FRAME_SIZE = 2048; // minus XDP headroom, still above our 1274 byte frames
+
+    int fd_ = -1;
+    unsigned char *umem_ = nullptr;
+    XskRing<uint64_t> fill_, comp_;
+    XskRing<struct xdp_desc> rx_;
+    uint32_t fill_prod_ = 0;
+    bool zerocopy_ = false;
+};
+
+// A receive socket with its own batch, reassembly state and counters; run
+// by exactly one thread.
+struct Worker {
+    int sock;
+    int reload_fd; // eventfd: subscriptions changed
+    unsigned int index, count;
+    bool kernel_subs; // subscriptions go into the socket filter
+    bool filtered = false; // the socket filter may reject datagrams
+    bool busy_poll = false; // spin instead of sleeping in epoll
+    RxBatch batch;
+    Reassembler rx;
+    RxStats stats;
+    LatencyStats latency;
+    std::unique_ptr<PacketRing> ring; // -B packet: sock is the ring's socket
+    std::unique_ptr<XdpRx> xsk;       // -B xdp: sock is the XSK, index its queue
+    std::unique_ptr<AsyncWriter> writer; // -A; last, so it stops before rx goes
+
+    Worker(int sock, unsigned int index, unsigned int count, unsigned int batch_size, bool gro, bool stamps, Reassembler &&rx)
+        : sock(sock), reload_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), index(index), count(count),
+          kernel_subs(!gro), batch(batch_size, gro, stamps), rx(std::move(rx)) {}
+
+    // Takes whatever is queued. Returns 1 once the run is complete, -1 on
+    // an error and 0 when there is nothing left.
+    int receive() {
+        int r;
+        if (xsk) r = xsk->receive(rx, stats);
+        else if (ring) r = ring->receive(rx, stats);
+        else r = receive_ready(sock, batch, rx, stats, latency, !filtered);
+        rx.submit_writes(); // one io_uring_enter per batch with -m uring
+        return r;
+    }
+
+    // (Re)builds the socket filter from the reassembler's subscriptions. A
+    // GRO buffer may mix stream_ids but would be judged by its first one, so
+    // with -G subscriptions are only checked in userspace.
+    bool apply_filter() {
+        const std::set<uint32_t> *subs = nullptr;
+        if (kernel_subs && !rx.subscribe_all()) {
+            subs = &rx.subscriptions();
+            if (subs->size() > MAX_FILTER_IDS) {
+                std::cerr << "Warning: more than " << MAX_FILTER_IDS << " subscriptions, filtering in userspace\n";
+                subs = nullptr;
+            }
+        }
+        if (xsk) return true; // the shared XDP program is swapped by main
+        if (ring) return ring->set_filter(subs);
+        return attach_stream_filter(sock, count, index, subs, &filtered);
+    }
+};
+
+// Event loop of one worker: drains its socket, fires its final-marker
+// deadlines from a timerfd, picks up new subscriptions from reload_fd and
+// returns once the run is complete or stop_fd becomes readable. Completion
+// or an error is passed on to the other workers through stop_fd.
+static void run_loop(Worker &w, int stop_fd) {
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (tfd < 0 || ep < 0) {
+        perror("timerfd/epoll");
+        if (tfd >= 0) close(tfd);
+        if (ep >= 0) close(ep);
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        return;
+    }
+    for (int fd : {w.sock, tfd, stop_fd, w.reload_fd}) {
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) perror("epoll_ctl");
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, the timerfd's clock.
+    auto armed = std::chrono::steady_clock::time_point::max();
+    auto next_check = std::chrono::steady_clock::now();
+    bool done = false, stop_others = false;
+    while (!done) {
+        if (w.busy_poll) {
+            // Spin on the socket; the timer, stop and reload fds are looked
+            // at about once a millisecond.
+            while (!done && std::chrono::steady_clock::now() < next_check) done = stop_others = (w.receive() != 0);
+            if (done) break;
+            next_check = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+        }
+        auto deadline = w.rx.next_deadline();
+        if (deadline != armed) {
+            struct itimerspec its{};
+            if (deadline != std::chrono::steady_clock::time_point::max()) {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+                its.it_value.tv_sec = ns / 1000000000;
+                its.it_value.tv_nsec = ns % 1000000000;
+                if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+            }
+            if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr) < 0) perror("timerfd_settime");
+            armed = deadline;
+        }
+
+        struct epoll_event events[8];
+        int n = epoll_wait(ep, events, 8, w.busy_poll ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            stop_others = true;
+            break;
+        }
+        for (int e = 0; e < n && !done; ++e) {
+            int fd = events[e].data.fd;
+            if (fd == w.sock) {
+                if (!w.busy_poll) done = stop_others = (w.receive() != 0);
+            } else if (fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("read(timerfd)");
+                armed = std::chrono::steady_clock::time_point::max();
+                done = stop_others = w.rx.check_timeouts();
+            } else if (fd == stop_fd) {
+                done = true;
+            } else if (fd == w.reload_fd) {
+                uint64_t n;
+                if (read(w.reload_fd, &n, sizeof(n)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+                w.rx.reload();
+                w.apply_filter();
+                // dropping the last unfinished subscription completes the run
+                done = stop_others = w.rx.all_done();
+            }
+        }
+    }
+    if (stop_others) {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    }
+    close(ep);
+    close(tfd);
+}
+
+// Number of RX queues of iface (its rx-N entries in sysfs), at least 1.
+static unsigned int rx_queue_count(const std::string &iface) {
+    DIR *d = opendir(("/sys/class/net/" + iface + "/queues").c_str());
+    if (!d) return 1;
+    unsigned int n = 0;
+    while (struct dirent *e = readdir(d)) {
+        if (std::strncmp(e->d_name, "rx-", 3) == 0) ++n;
+    }
+    closedir(d);
+    return std::max(n, 1u);
 }
 
 int main(int argc, char** argv) {
     std::string iface;
     std::string addr = "ff3e::1";
     int port = 12345;
-    std::string out_pattern = "stream_{id}.mp4";
+    OutputOptions out;
+    out.pattern = "stream_{id}.mp4";
+    std::string write_mode = "stream";
+    std::string size_hint = "0";
+    bool async_write = false;
+    std::string queue_mem = std::to_string(DEFAULT_QUEUE_MEM);
+    std::string sync_every = "0";
     std::string subscribe = "all"; // "all" or comma list
     int timeout = 10;
+    unsigned int batch = DEFAULT_BATCH;
+    bool gro = false;
+    unsigned int nworkers = 1;
+    std::string backend = "socket";
+    std::string xdp_mode = "auto";
+    int busy_usec = 0;
+    int first_cpu = -1;
+    int fifo_prio = 0;
+    bool measure_latency = false;
+    std::string bitrate = "100M"; // expected total rate, sizes the receive buffer
+    unsigned long window_req = DEFAULT_WINDOW;
 
     for (int i = 1; i < argc; ++i) {
         std::string a(argv[i]);
         if ((a == "-i" || a == "--iface") && i + 1 < argc) iface = argv[++i];
         else if ((a == "-a" || a == "--addr") && i + 1 < argc) addr = argv[++i];
         else if ((a == "-p" || a == "--port") && i + 1 < argc) port = std::stoi(argv[++i]);
-        else if ((a == "-o" || a == "--out") && i + 1 < argc) out_pattern = argv[++i];
+        else if ((a == "-o" || a == "--out") && i + 1 < argc) out.pattern = argv[++i];
         else if ((a == "-s" || a == "--subscribe") && i + 1 < argc) subscribe = argv[++i];
         else if ((a == "-t" || a == "--timeout") && i + 1 < argc) timeout = std::stoi(argv[++i]);
+        else if ((a == "-b" || a == "--batch") && i + 1 < argc) batch = static_cast<unsigned int>(std::stoul(argv[++i]));
+        else if (a == "-G" || a == "--gro") gro = true;
+        else if ((a == "-w" || a == "--workers") && i + 1 < argc) nworkers = static_cast<unsigned int>(std::stoul(argv[++i]));
+        else if ((a == "-B" || a == "--backend") && i + 1 < argc) backend = argv[++i];
+        else if ((a == "-x" || a == "--xdp-mode") && i + 1 < argc) xdp_mode = argv[++i];
+        else if ((a == "-P" || a == "--busy-poll") && i + 1 < argc) busy_usec = std::stoi(argv[++i]);
+        else if ((a == "-C" || a == "--cpu") && i + 1 < argc) first_cpu = std::stoi(argv[++i]);
+        else if ((a == "-F" || a == "--fifo") && i + 1 < argc) fifo_prio = std::stoi(argv[++i]);
+        else if (a == "-L" || a == "--latency") measure_latency = true;
+        else if ((a == "-R" || a == "--bitrate") && i + 1 < argc) bitrate = argv[++i];
+        else if ((a == "-W" || a == "--window") && i + 1 < argc) window_req = std::stoul(argv[++i]);
+        else if ((a == "-m" || a == "--write-mode") && i + 1 < argc) write_mode = argv[++i];
+        else if ((a == "-z" || a == "--size-hint") && i + 1 < argc) size_hint = argv[++i];
+        else if (a == "-A" || a == "--async-write") async_write = true;
+        else if ((a == "-Q" || a == "--queue-mem") && i + 1 < argc) queue_mem = argv[++i];
+        else if ((a == "-Y" || a == "--sync-every") && i + 1 < argc) sync_every = argv[++i];
         else if (a == "-h" || a == "--help") {
-            std::cerr << "Usage: " << argv[0] << " -s all|id1,id2 [-o pattern] [-a addr] [-p port] [-i iface] [-t timeout]\n";
+            std::cerr << "Usage: " << argv[0] << " -s all|id1,id2 [-o pattern] [-a addr] [-p port] [-i iface] [-t timeout] [-b batch] [-G]"
+                      << " [-w workers] [-B socket|packet|xdp] [-x auto|native|generic] [-P usec] [-C cpu] [-F prio] [-L]"
+                      << " [-R bitrate] [-W window] [-m stream|pwrite|mmap|uring] [-z size] [-A] [-Q bytes] [-Y bytes]\n";
             return 1;
         }
     }
+    if (batch < 1) batch = 1;
+    if (batch > UIO_MAXIOV) batch = UIO_MAXIOV;
+    if (nworkers < 1 || nworkers > MAX_WORKERS) {
+        std::cerr << "Error: -w must be between 1 and " << MAX_WORKERS << "\n";
+        return 1;
+    }
+    if (nworkers > 1 && gro) {
+        // A coalesced buffer may mix stream_ids but is filtered on its first.
+        std::cerr << "Error: -G cannot be combined with -w\n";
+        return 1;
+    }
+    const bool raw_packet = (backend == "packet"), raw_xdp = (backend == "xdp");
+    if (!raw_packet && !raw_xdp && backend != "socket") {
+        std::cerr << "Error: unknown backend: " << backend << "\n";
+        return 1;
+    }
+    if ((raw_packet || raw_xdp) && (nworkers > 1 || gro || iface.empty())) {
+        std::cerr << "Error: -B " << backend << " needs -i and cannot be combined with -w or -G\n";
+        return 1;
+    }
+    if (measure_latency && (raw_packet || raw_xdp)) {
+        std::cerr << "Error: -L needs the socket backend\n";
+        return 1;
+    }
+    if (write_mode == "pwrite") out.mode = OutputMode::PWRITE;
+    else if (write_mode == "mmap") out.mode = OutputMode::MMAP;
+    else if (write_mode == "uring") out.mode = OutputMode::URING;
+    else if (write_mode != "stream") {
+        std::cerr << "Error: unknown write mode: " << write_mode << "\n";
+        return 1;
+    }
+    if (out.mode != OutputMode::STREAM && out.pattern == "-") {
+        std::cerr << "Error: -m " << write_mode << " needs an output file, not stdout\n";
+        return 1;
+    }
+    if (out.mode == OutputMode::URING && async_write) {
+        std::cerr << "Error: -m uring writes asynchronously already, drop -A\n";
+        return 1;
+    }
+    // Reorder window: a power of two of whole bitmap words.
+    uint32_t window = 64;
+    while (window < window_req && window < MAX_WINDOW) window <<= 1;
+    double rate_bps = 0;
+    try {
+        rate_bps = parse_bitrate(bitrate);
+    } catch (const std::exception &) {
+        std::cerr << "Error: invalid bit rate: " << bitrate << "\n";
+        return 1;
+    }
+    size_t queue_bytes = 0;
+    std::string size_arg = size_hint;
+    try {
+        out.size_hint = parse_size(size_arg);
+        size_arg = queue_mem;
+        queue_bytes = parse_size(size_arg);
+        size_arg = sync_every;
+        out.sync_every = parse_size(size_arg);
+    } catch (const std::exception &) {
+        std::cerr << "Error: invalid size: " << size_arg << "\n";
+        return 1;
+    }
+    if (out.sync_every > 0 && out.mode != OutputMode::URING) {
+        std::cerr << "Error: -Y needs -m uring\n";
+        return 1;
+    }
+    if (busy_usec < 0 || fifo_prio < 0 || fifo_prio > sched_get_priority_max(SCHED_FIFO)) {
+        std::cerr << "Error: invalid -P or -F value\n";
+        return 1;
+    }
+    if (xdp_mode != "auto" && xdp_mode != "native" && xdp_mode != "generic") {
+        std::cerr << "Error: unknown XDP mode: " << xdp_mode << "\n";
+        return 1;
+    }
 
-    bool subscribe_all = (subscribe == "all");
-    std::set<uint32_t> subs;
-    if (!subscribe_all) subs = parse_list(subscribe);
+    RunState run;
+    if (!load_subscriptions(subscribe, &run.all, &run.subs)) {
+        std::cerr << "Error: cannot read subscriptions from " << subscribe.substr(1) << "\n";
+        return 1;
+    }
 
     unsigned int ifindex = 0;
     if (!iface.empty()) {
@@ -84,199 +2268,285 @@ int main(int argc, char** argv) {
         if (ifindex == 0) std::cerr << "Warning: interface not found: " << iface << "\n";
     }
 
-    int sock = ::socket(AF_INET6, SOCK_DGRAM, 0);
-    if (sock < 0) { perror("socket"); return 2; }
-
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-        perror("setsockopt(SO_REUSEADDR)");
-    }
-#ifdef SO_REUSEPORT
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
-        perror("setsockopt(SO_REUSEPORT)");
-    }
-#endif
-
-    struct sockaddr_in6 local{};
-    local.sin6_family = AF_INET6;
-    local.sin6_addr = in6addr_any;
-    local.sin6_port = htons(port);
-    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) < 0) { perror("bind"); close(sock); return 3; }
-
     struct ipv6_mreq mreq{};
     if (inet_pton(AF_INET6, addr.c_str(), &mreq.ipv6mr_multiaddr) != 1) {
         std::cerr << "Error: invalid IPv6 address: " << addr << "\n";
-        close(sock);
         return 4;
     }
     mreq.ipv6mr_interface = ifindex;
-    if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
-        perror("setsockopt(IPV6_JOIN_GROUP)");
-        close(sock);
-        return 5;
-    }
 
-    // recv timeout
-    struct timeval tv{};
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        perror("setsockopt(SO_RCVTIMEO)");
+    // SIGINT/SIGTERM (flush and exit) and SIGHUP (reload -s @file) arrive on
+    // a signalfd in this thread. Blocked before any worker starts, so no
+    // worker takes them directly.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    int stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sfd < 0 || stop_fd < 0) {
+        perror("signalfd/eventfd");
+        return 6;
     }
 
-    std::cerr << "Listening on [" << addr << "]:" << port << " (iface=" << iface << "), subscribe=" << subscribe << "\n";
-
-    std::map<uint32_t, StreamState> streams;
-    std::vector<char> rxbuf(MAX_PKT);
-
-    bool single_to_stdout = false;
-    if (!subscribe_all && subs.size() == 1 && out_pattern == "-") single_to_stdout = true;
+    // Subscriptions for a kernel-side filter: null for any stream.
+    auto filter_subs = [](bool all, const std::set<uint32_t> &ids) -> const std::set<uint32_t>* {
+        if (all) return nullptr;
+        if (ids.size() > MAX_FILTER_IDS) {
+            std::cerr << "Warning: more than " << MAX_FILTER_IDS << " subscriptions, filtering in userspace\n";
+            return nullptr;
+        }
+        return &ids;
+    };
 
-    while (true) {
-        ssize_t n = recv(sock, rxbuf.data(), rxbuf.size(), 0);
-        if (n < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
-                // timeout / check final timeouts
-                for (auto &p : streams) {
-                    StreamState &st = p.second;
-                    if (st.final_seen) {
-                        auto now = std::chrono::steady_clock::now();
-                        if (std::chrono::duration_cast<std::chrono::seconds>(now - st.final_at).count() > timeout) {
-                            std::cerr << "Timeout waiting for missing packets for stream " << p.first << "\n";
-                            // allow finishing
-                            st.final_seen = false; // break condition below uses expected > final_seq
-                        }
-                    }
-                }
-                // check global finish condition only per-stream (we don't auto-exit unless all subscribed streams finished)
-                bool all_done = true;
-                if (subscribe_all) all_done = false; // don't auto-exit
-                else {
-                    for (uint32_t sid : subs) {
-                        auto it = streams.find(sid);
-                        if (it == streams.end()) { all_done = false; break; }
-                        StreamState &st = it->second;
-                        if (!(st.final_seen && st.expected > st.final_seq)) { all_done = false; break; }
-                    }
-                }
-                if (all_done) break;
-                continue;
-            } else {
-                perror("recv");
-                break;
+    std::unique_ptr<XdpProgram> xdp;
+    std::vector<std::unique_ptr<Worker>> workers;
+    int join_sock = -1;
+    if (raw_packet || raw_xdp) {
+        // The UDP socket only keeps the group joined (MLD, NIC multicast
+        // filter); a drop-all filter keeps its queue empty.
+        int rc = 0;
+        join_sock = open_socket(port, mreq, &gro, &rc);
+        if (join_sock < 0) return rc;
+        std::vector<struct sock_filter> drop_all = {BPF_STMT(BPF_RET | BPF_K, 0)};
+        if (!attach_filter(join_sock, drop_all)) return 6;
+    }
+    if (raw_xdp) {
+        // One XSK and worker per RX queue: the NIC's RSS keeps each sender's
+        // flow, and so each stream, on one queue.
+        nworkers = std::min(rx_queue_count(iface), MAX_WORKERS);
+        xdp.reset(new XdpProgram);
+        if (!xdp->open(ifindex, nworkers, mreq.ipv6mr_multiaddr, port, filter_subs(run.all, run.subs), xdp_mode)) {
+            std::cerr << "Error: cannot attach the XDP program to " << iface << "\n";
+            return 6;
+        }
+        bool zerocopy = false;
+        for (unsigned int q = 0; q < nworkers; ++q) {
+            std::unique_ptr<XdpRx> xsk(new XdpRx);
+            if (!xsk->open(ifindex, q, xdp->native()) || !xdp->add_socket(q, xsk->fd())) {
+                std::cerr << "Error: cannot set up the AF_XDP socket on " << iface << " queue " << q << "\n";
+                return 6;
             }
+            zerocopy = xsk->zerocopy();
+            workers.emplace_back(new Worker(xsk->fd(), q, nworkers, 1, false, false, Reassembler(out, timeout, window, run)));
+            workers.back()->xsk = std::move(xsk);
+            if (workers.back()->reload_fd < 0) return 6;
         }
+        std::cerr << "XDP program attached in " << (xdp->native() ? "native" : "generic") << " mode, " << nworkers
+                  << " queue(s), " << (zerocopy ? "zero-copy" : "copy mode") << "\n";
+    }
+    if (raw_packet) {
+        std::unique_ptr<PacketRing> ring(new PacketRing);
+        Reassembler rx(out, timeout, window, run);
+        if (!ring->open(ifindex, mreq.ipv6mr_multiaddr, port, rx.subscribe_all() ? nullptr : &rx.subscriptions())) {
+            std::cerr << "Error: cannot set up the AF_PACKET RX ring on " << iface << "\n";
+            return 6;
+        }
+        workers.emplace_back(new Worker(ring->fd(), 0, 1, 1, false, false, std::move(rx)));
+        workers.back()->ring = std::move(ring);
+        if (workers.back()->reload_fd < 0) return 6;
+    }
+    // Room for RCVBUF_WINDOW_S of traffic at -R; every worker socket sees
+    // the whole rate until its filter runs.
+    int rcvbuf_want = static_cast<int>(std::min(std::max(rate_bps / 8 * RCVBUF_WINDOW_S, double(MIN_RCVBUF)), 1e9));
+    int rcvbuf = 0;
+    int64_t rcvbuf_errors = udp6_rcvbuf_errors();
+    for (unsigned int k = 0; k < nworkers && !raw_packet && !raw_xdp; ++k) {
+        int rc = 0;
+        int sock = open_socket(port, mreq, &gro, &rc);
+        if (sock < 0) return rc;
+        rcvbuf = size_rcvbuf(sock, rcvbuf_want);
+        if (k == 0 && rcvbuf < rcvbuf_want) {
+            std::cerr << "Warning: receive buffer limited to " << rcvbuf / 1024 << " KB instead of " << rcvbuf_want / 1024
+                      << " KB (raise net.core.rmem_max or run with CAP_NET_ADMIN)\n";
+        }
+        workers.emplace_back(new Worker(sock, k, nworkers, batch, gro, measure_latency, Reassembler(out, timeout, window, run)));
+        if (workers.back()->reload_fd < 0 || !workers.back()->apply_filter()) {
+            std::cerr << "Error: cannot set up the socket filter\n";
+            return 6;
+        }
+        int on = 1;
+        if (measure_latency && setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+            perror("setsockopt(SO_TIMESTAMPNS)");
+            return 6;
+        }
+    }
+    if (busy_usec > 0) {
+        if (fifo_prio > 0 && std::thread::hardware_concurrency() <= workers.size()) {
+            std::cerr << "Warning: SCHED_FIFO busy-poll workers without a spare CPU will starve the rest of the system\n";
+        }
+        for (auto &w : workers) {
+            enable_busy_poll(w->sock, busy_usec, static_cast<int>(batch));
+            w->busy_poll = true;
+        }
+    }
 
-        if ((size_t)n < HDR_LEN) continue;
-
-        uint32_t sid_be = 0, seq_be = 0, flags_be = 0;
-        std::memcpy(&sid_be, rxbuf.data(), 4);
-        std::memcpy(&seq_be, rxbuf.data()+4, 4);
-        std::memcpy(&flags_be, rxbuf.data()+8, 4);
-        uint32_t sid = ntohl(sid_be), seq = ntohl(seq_be), flags = ntohl(flags_be);
-
-        if (!subscribe_all) {
-            if (subs.find(sid) == subs.end()) continue; // not subscribed
+    if (async_write) {
+        for (auto &w : workers) {
+            w->writer.reset(new AsyncWriter(queue_bytes / workers.size()));
+            if (!w->writer->start()) {
+                perror("eventfd");
+                return 6;
+            }
+            w->rx.set_writer(w->writer.get());
         }
+    }
 
-        // ensure stream state exists
-        StreamState &st = streams[sid];
+    std::cerr << "Listening on [" << addr << "]:" << port << " (iface=" << iface << "), subscribe=" << subscribe
+              << ", batch=" << batch << ", gro=" << (gro ? "on" : "off") << ", workers=" << nworkers << ", backend=" << backend
+              << ", window=" << window;
+    if (rcvbuf > 0) std::cerr << ", rcvbuf=" << rcvbuf / 1024 << "KB";
+    std::cerr << "\n";
 
-        // open file if not yet
-        if (!st.has_file) {
-            if (!single_to_stdout) {
-                // create filename from pattern
-                std::string fname = out_pattern;
-                size_t pos = fname.find("{id}");
-                if (pos != std::string::npos) {
-                    fname.replace(pos, 4, std::to_string(sid));
+    // Workers receive; this thread only handles signals and waits for a
+    // worker to end the run.
+    std::vector<std::thread> threads;
+    threads.reserve(workers.size());
+    uint64_t allocs_start = g_new_calls.load();
+    auto recv_start = std::chrono::steady_clock::now();
+    for (auto &w : workers) threads.emplace_back(run_loop, std::ref(*w), stop_fd);
+    for (size_t k = 0; k < threads.size(); ++k) {
+        // A spinning worker wants a core of its own: -C cpu pins worker k to
+        // cpu + k, -F runs it ahead of everything that is not real-time.
+        if (first_cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(first_cpu + static_cast<int>(k), &set);
+            int err = pthread_setaffinity_np(threads[k].native_handle(), sizeof(set), &set);
+            if (err) std::cerr << "Warning: cannot pin worker " << k << " to CPU " << first_cpu + k << ": " << strerror(err) << "\n";
+        }
+        if (fifo_prio > 0) {
+            struct sched_param sp{};
+            sp.sched_priority = fifo_prio;
+            int err = pthread_setschedparam(threads[k].native_handle(), SCHED_FIFO, &sp);
+            if (err) std::cerr << "Warning: cannot set SCHED_FIFO for worker " << k << ": " << strerror(err) << "\n";
+        }
+    }
+    struct pollfd pfd[2] = {{sfd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    while (!(pfd[1].revents & POLLIN)) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        struct signalfd_siginfo si;
+        if (!(pfd[0].revents & POLLIN) || read(sfd, &si, sizeof(si)) != sizeof(si)) continue;
+        if (si.ssi_signo == SIGHUP) {
+            bool all = true;
+            std::set<uint32_t> ids;
+            if (subscribe[0] != '@') {
+                std::cerr << "SIGHUP ignored: subscriptions are not read from a file (-s @file)\n";
+            } else if (!load_subscriptions(subscribe, &all, &ids)) {
+                std::cerr << "Warning: cannot re-read " << subscribe.substr(1) << ", keeping subscriptions\n";
+            } else {
+                {
+                    std::lock_guard<std::mutex> g(run.lock);
+                    run.all = all;
+                    run.subs = ids;
                 }
-                st.fout.open(fname, std::ios::binary);
-                if (!st.fout) {
-                    std::cerr << "Error: cannot open output file: " << fname << " for stream " << sid << "\n";
-                } else {
-                    st.has_file = true;
-                    std::cerr << "Opened output file " << fname << " for stream " << sid << "\n";
+                std::cerr << "Subscriptions reloaded (" << (all ? std::string("all") : std::to_string(ids.size()) + " streams")
+                          << ")\n";
+                if (xdp) xdp->update(filter_subs(all, ids));
+                uint64_t one = 1;
+                for (auto &w : workers) {
+                    if (write(w->reload_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
                 }
-            } else {
-                std::cerr << "Streaming stream " << sid << " to stdout\n";
-                st.has_file = false; // writing to stdout handled below
             }
+            continue;
         }
+        std::cerr << "Interrupted by signal " << si.ssi_signo << ", flushing\n";
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        break;
+    }
+    for (std::thread &t : threads) t.join();
+    uint64_t allocs = g_new_calls.load() - allocs_start;
+    double recv_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - recv_start).count();
 
-        std::vector<char> payload;
-        if ((size_t)n > HDR_LEN) payload.assign(rxbuf.begin()+HDR_LEN, rxbuf.begin()+n);
+    RxStats stats;
+    LatencyStats latency;
+    for (auto &w : workers) {
+        w->rx.finish();
+        if (w->writer) w->writer->stop();
+        latency.merge(w->latency);
+        stats.datagrams += w->stats.datagrams;
+        stats.buffers += w->stats.buffers;
+        stats.bytes += w->stats.bytes;
+        stats.syscalls += w->stats.syscalls;
+        stats.dropped += w->stats.dropped;
+    }
 
-        if (seq < st.expected) {
-            continue; // duplicate/old
-        } else if (seq == st.expected) {
-            if (!payload.empty()) {
-                if (single_to_stdout && streams.size() == 1 && st.has_file==false) {
-                    std::cout.write(payload.data(), payload.size());
-                    std::cout.flush();
-                } else if (st.has_file) {
-                    st.fout.write(payload.data(), payload.size());
-                }
-            }
-            st.expected++;
-            // flush buffered
-            while (true) {
-                auto it = st.buffer.find(st.expected);
-                if (it == st.buffer.end()) break;
-                if (!it->second.empty()) {
-                    if (single_to_stdout && streams.size() == 1 && st.has_file==false) {
-                        std::cout.write(it->second.data(), it->second.size());
-                        std::cout.flush();
-                    } else if (st.has_file) {
-                        st.fout.write(it->second.data(), it->second.size());
-                    }
-                }
-                st.buffer.erase(it);
-                st.expected++;
-            }
+    if ((raw_packet || raw_xdp) && stats.buffers > 0) {
+        std::cerr << "Received " << stats.datagrams << " datagrams (" << stats.bytes << " bytes) from " << stats.buffers
+                  << (raw_xdp ? " XSK batches, " : " ring blocks, ") << double(stats.datagrams) / double(stats.buffers)
+                  << (raw_xdp ? " datagrams/batch" : " datagrams/block");
+        if (stats.dropped > 0) std::cerr << ", " << stats.dropped << " frames dropped (truncated or bad checksum)";
+        std::cerr << "\n";
+    }
+    for (auto &w : workers) {
+        if (w->xsk) w->xsk->report(w->index);
+    }
+    if (rcvbuf > 0) {
+        // Loss the kernel saw; the rest of any gap was lost before the host.
+        int64_t now_errors = udp6_rcvbuf_errors();
+        std::cerr << "Receive buffer " << rcvbuf / 1024 << " KB: ";
+        if (rcvbuf_errors >= 0 && now_errors >= 0) {
+            std::cerr << now_errors - rcvbuf_errors << " datagrams dropped on full receive buffers (Udp6RcvbufErrors of the"
+                      << " network namespace)" << (now_errors > rcvbuf_errors ? ", raise -R" : "") << "\n";
         } else {
-            // out of order
-            if (st.buffer.find(seq) == st.buffer.end()) st.buffer[seq] = std::move(payload);
+            std::cerr << "drop count unavailable (/proc/net/snmp6)\n";
         }
-
-        if (flags & FLAG_FINAL) {
-            st.final_seen = true;
-            st.final_seq = seq;
-            st.final_at = std::chrono::steady_clock::now();
-            std::cerr << "Final marker seen for stream " << sid << " seq=" << seq << "\n";
+        bool split = true;
+        for (auto &w : workers) {
+            w->rx.report_kernel_drops();
+            split = split && !w->filtered;
         }
-
-        // If this stream finished, optionally close file
-        if (st.final_seen && st.expected > st.final_seq) {
-            std::cerr << "Stream " << sid << " finished (expected=" << st.expected << " final=" << st.final_seq << ")\n";
-            if (st.has_file && st.fout.is_open()) st.fout.close();
-            // if subscribed to a finite set of streams and all finished, exit; handled in timeout check above
-            if (!subscribe_all) {
-                bool all_done = true;
-                for (uint32_t sid2 : subs) {
-                    auto it = streams.find(sid2);
-                    if (it == streams.end()) { all_done = false; break; }
-                    StreamState &st2 = it->second;
-                    if (!(st2.final_seen && st2.expected > st2.final_seq)) { all_done = false; break; }
-                }
-                if (all_done) break;
-            }
+        if (!split && now_errors > rcvbuf_errors) {
+            std::cerr << "  (per-stream split only without a socket filter: -s all, one worker)\n";
         }
     }
+    size_t slabs = 0, peak = 0;
+    for (auto &w : workers) {
+        slabs += w->rx.pool().slabs();
+        peak += w->rx.pool().peak();
+    }
+    std::cerr << "operator new calls while receiving: " << allocs << " (" << double(allocs) / recv_s << "/s); packet pool "
+              << slabs << " slab(s) of " << PacketPool::SLAB_SLOTS << " slots, peak " << peak << " in use\n";
+    for (auto &w : workers) {
+        if (w->writer) w->writer->report(w->index);
+        w->rx.report_writes(w->index);
+    }
+    if (latency.count > 0) {
+        std::cerr << "Latency kernel receive -> processing (" << (busy_usec > 0 ? "busy-poll" : "epoll") << ", "
+                  << latency.count << " buffers): min " << latency.min_ns / 1e3 << " us, avg "
+                  << double(latency.sum_ns) / double(latency.count) / 1e3 << " us, p50 " << latency.percentile(50) / 1e3
+                  << " us, p99 " << latency.percentile(99) / 1e3 << " us, max " << latency.max_ns / 1e3 << " us\n";
+    }
 
-    // flush remaining buffered in-order
-    for (auto &p : streams) {
-        StreamState &st = p.second;
-        while (true) {
-            auto it = st.buffer.find(st.expected);
-            if (it == st.buffer.end()) break;
-            if (st.has_file) st.fout.write(it->second.data(), it->second.size());
-            st.buffer.erase(it);
-            st.expected++;
+    if (stats.syscalls > 0 && !raw_xdp) {
+        double fill = double(stats.buffers) / double(stats.syscalls);
+        std::cerr << "Received " << stats.datagrams << " datagrams (" << stats.bytes << " bytes) in " << stats.syscalls
+                  << " syscalls, " << double(stats.datagrams) / double(stats.syscalls) << " datagrams/syscall (batch fill "
+                  << 100.0 * fill / batch << "%)\n";
+        if (gro) {
+            std::cerr << "GRO: " << stats.datagrams << " datagrams in " << stats.buffers << " buffers, "
+                      << double(stats.datagrams) / double(stats.buffers) << " datagrams/buffer\n";
+        }
+        if (nworkers > 1) {
+            for (unsigned int k = 0; k < nworkers; ++k) {
+                std::cerr << "  worker " << k << ": " << workers[k]->stats.datagrams << " datagrams\n";
+            }
         }
-        if (st.has_file && st.fout.is_open()) st.fout.close();
     }
 
-    close(sock);
+    for (auto &w : workers) {
+        if (!w->ring && !w->xsk) close(w->sock);
+        close(w->reload_fd);
+    }
+    if (join_sock >= 0) close(join_sock);
+    close(stop_fd);
+    close(sfd);
     return 0;
 }
@@ -1,39 +1,1060 @@
 /* src/sender.cpp
    C++ IPv6 multicast sender (roundsend) with stream_id.
-   Header per packet (12 bytes):
-     4 bytes stream_id (BE)
-     4 bytes sequence  (BE)
-     4 bytes flags     (BE) - bit0 = final
+   Header per packet: 12 bytes, see src/common.h.
+   With -b N > 1 up to N packets are queued and flushed with one sendmmsg().
+   With -G consecutive packets are sent as UDP GSO super-datagrams (UDP_SEGMENT).
+   With -m the file is memory-mapped and payloads are sent straight from the
+   mapping (iovec pair: header slot + mapped chunk) instead of read() copies.
+   With -Z sends use MSG_ZEROCOPY; batch slots are recycled only after the
+   kernel reports their completion on the socket error queue.
+   With -U file reads and sends run through io_uring: each packet is a linked
+   READ_FIXED -> SEND pair on registered buffers and fixed files, with many
+   pairs in flight so disk latency overlaps the network.
+   With -P fq|txtime the -r/-R rate is enforced by the kernel: SO_MAX_PACING_RATE
+   for the fq qdisc, or per-packet SCM_TXTIME launch times (CLOCK_MONOTONIC,
+   so fq; etf would need CLOCK_TAI).
+   With -B packet complete Ethernet/IPv6/UDP frames are written into an
+   AF_PACKET TX ring (TPACKET_V3) that bypasses the qdisc layer; -B xdp
+   posts them from a pre-filled UMEM on an AF_XDP socket.
+   With --stream file,id[,rate[,weight]] (repeatable) one process sends many
+   files; a deficit round robin scheduler interleaves them by weight, each
+   under its own optional rate, with -r/-R as the global cap.
 */
 #include <arpa/inet.h>
+#include <errno.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
-static constexpr size_t PAYLOAD_SIZE = 1200;
-static constexpr size_t HDR_LEN = 12;
-static constexpr uint32_t FLAG_FINAL = 1;
+#include "common.h"
+
+static constexpr size_t PKT_LEN = HDR_LEN + PAYLOAD_SIZE;
+// A GSO send is one IPv6 UDP datagram, so at most 65527 bytes of segments.
+static constexpr unsigned int GSO_MAX_SEGS = 65527 / PKT_LEN;
+// Batch slot sets rotated in zero-copy mode so filling overlaps completion.
+static constexpr unsigned int ZC_SETS = 4;
+// Zero-copy pins each iovec as skb page frags (MAX_SKB_FRAGS, 17 by default)
+// and a header + payload pair can span 3 pages, so GSO runs must be shorter.
+static constexpr unsigned int ZC_GSO_MAX_SEGS = 17 / 3;
+// io_uring pipeline: packet slots in flight (two SQEs each) and ring size.
+static constexpr unsigned int URING_SLOTS = 128;
+static constexpr unsigned int URING_ENTRIES = 2 * URING_SLOTS;
+// Per-packet bytes the qdisc charges against SO_MAX_PACING_RATE
+// (Ethernet, IPv6 and UDP headers on top of the datagram).
+static constexpr uint64_t WIRE_OVERHEAD = L2L4_LEN;
+// SO_TXTIME: how far ahead of its first launch time a batch is handed over.
+static constexpr uint64_t TXTIME_LEAD_NS = 2000000;
 
 volatile sig_atomic_t g_interrupted = 0;
 void sigint_handler(int) { g_interrupted = 1; }
 
+static void put_header(char *p, uint32_t stream_id, uint32_t seq, uint32_t flags) {
+    uint32_t sid_be = htonl(stream_id), seq_be = htonl(seq), flags_be = htonl(flags);
+    std::memcpy(p, &sid_be, 4);
+    std::memcpy(p+4, &seq_be, 4);
+    std::memcpy(p+8, &flags_be, 4);
+}
+
+// Payload source: buffered ifstream reads (default) or a read-only mapping.
+class FileSource {
+public:
+    ~FileSource() {
+        if (map_ && map_ != MAP_FAILED) munmap(map_, size_);
+    }
+
+    bool open(const std::string &path, bool use_mmap) {
+        if (!use_mmap) {
+            in_.open(path, std::ios::binary);
+            return static_cast<bool>(in_);
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat sb;
+        if (fstat(fd, &sb) < 0) { close(fd); return false; }
+        size_ = static_cast<size_t>(sb.st_size);
+        mapped_ = true;
+        if (size_ > 0) {
+            map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (map_ == MAP_FAILED) { perror("mmap"); close(fd); return false; }
+            if (madvise(map_, size_, MADV_SEQUENTIAL) < 0) perror("madvise(MADV_SEQUENTIAL)");
+        }
+        close(fd); // the mapping keeps the file referenced
+        return true;
+    }
+
+    // Produces the next chunk of up to PAYLOAD_SIZE bytes. For mapped files
+    // *payload points into the mapping; otherwise the chunk is read into
+    // scratch. Returns 0 when the file is exhausted.
+    size_t next(char *scratch, const char **payload, bool *is_final) {
+        if (mapped_) {
+            if (off_ >= size_) return 0;
+            size_t n = std::min(PAYLOAD_SIZE, size_ - off_);
+            *payload = static_cast<const char*>(map_) + off_;
+            off_ += n;
+            *is_final = (off_ == size_);
+            return n;
+        }
+        in_.read(scratch, PAYLOAD_SIZE);
+        std::streamsize n = in_.gcount();
+        // If no bytes read and EOF, we're done (this handles exact-multiple sizes)
+        if (n <= 0) return 0;
+        *payload = scratch;
+        // final if we read less than PAYLOAD_SIZE OR if EOF is set after read
+        *is_final = (static_cast<size_t>(n) < PAYLOAD_SIZE) || in_.eof();
+        return static_cast<size_t>(n);
+    }
+
+    bool mapped() const { return mapped_; }
+
+private:
+    std::ifstream in_;
+    bool mapped_ = false;
+    void *map_ = nullptr;
+    size_t size_ = 0;
+    size_t off_ = 0;
+};
+
+// Transmit counters; packets/syscalls is the achieved batching factor.
+struct TxStats {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+};
+
+// MSG_ZEROCOPY bookkeeping. The kernel numbers every zero-copy send
+// (one per sendmsg / sendmmsg entry) from 0 and reports released ranges
+// [lo, hi] on the error queue, possibly out of order.
+class ZeroCopy {
+public:
+    explicit ZeroCopy(size_t window) : done_(window, 0) {}
+
+    // Id the next accepted send will get.
+    uint32_t next_id() const { return next_; }
+    void sent(unsigned int n) { next_ += n; }
+
+    // True once every send with id <= last has been released.
+    bool released(uint32_t last) const { return int32_t(last - released_) < 0; }
+    bool idle() const { return released_ == next_; }
+
+    // Drains completion notifications; waits up to timeout_ms for the first one.
+    void reap(int sock, int timeout_ms) {
+        if (timeout_ms != 0) {
+            struct pollfd pfd{};
+            pfd.fd = sock;
+            pfd.events = 0; // POLLERR is always reported
+            if (poll(&pfd, 1, timeout_ms) <= 0) return;
+        }
+        while (true) {
+            char ctrl[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+            struct msghdr mh{};
+            mh.msg_control = ctrl;
+            mh.msg_controllen = sizeof(ctrl);
+            if (recvmsg(sock, &mh, MSG_ERRQUEUE) < 0) return; // EAGAIN: queue drained
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+                if (cm->cmsg_level != SOL_IPV6 || cm->cmsg_type != IPV6_RECVERR) continue;
+                struct sock_extended_err ee;
+                std::memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+                if (ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno != 0) continue;
+                uint32_t n = ee.ee_data - ee.ee_info + 1;
+                if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) copied += n; else zerocopy += n;
+                for (uint32_t id = ee.ee_info; id != ee.ee_data + 1; ++id) done_[id % done_.size()] = 1;
+            }
+            while (released_ != next_ && done_[released_ % done_.size()]) {
+                done_[released_ % done_.size()] = 0;
+                ++released_;
+            }
+        }
+    }
+
+    uint64_t zerocopy = 0; // sends transmitted straight from user pages
+    uint64_t copied = 0;   // sends the kernel had to copy after all
+
+private:
+    std::vector<uint8_t> done_;
+    uint32_t next_ = 0;
+    uint32_t released_ = 0;
+};
+
+// Retries a send that failed because too many zero-copy notifications are
+// outstanding (optmem exhausted). Returns true if the caller should retry.
+static bool zc_backoff(int sock, ZeroCopy *zc) {
+    if (!zc || errno != ENOBUFS) return false;
+    zc->reap(sock, 100);
+    return true;
+}
+
+// Appends an SCM_TXTIME launch time to mh's control buffer at offset used;
+// returns the new control length.
+static size_t put_txtime(struct msghdr &mh, size_t used, uint64_t launch_ns) {
+    struct cmsghdr *cm = reinterpret_cast<struct cmsghdr*>(static_cast<char*>(mh.msg_control) + used);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    std::memcpy(CMSG_DATA(cm), &launch_ns, sizeof(launch_ns));
+    return used + CMSG_SPACE(sizeof(uint64_t));
+}
+
+// Sends msgs[0..count) with as few sendmmsg() calls as the kernel allows;
+// a single packet goes out with plain sendmsg(). Returns false on a hard socket error.
+// Control data (SCM_TXTIME) must already be attached by the caller.
+static bool flush_batch(int sock, struct mmsghdr *msgs, unsigned int count, TxStats &stats, ZeroCopy *zc) {
+    int flags = zc ? MSG_ZEROCOPY : 0;
+    if (count == 1) {
+        ssize_t wrote;
+        for (;;) {
+            wrote = sendmsg(sock, &msgs[0].msg_hdr, flags);
+            stats.syscalls++;
+            if (wrote >= 0 || (errno != EINTR && !zc_backoff(sock, zc))) break;
+        }
+        if (wrote < 0) {
+            perror("sendmsg");
+            return false;
+        }
+        stats.packets++;
+        stats.bytes += wrote;
+        if (zc) zc->sent(1);
+        return true;
+    }
+    unsigned int done = 0;
+    while (done < count) {
+        int r = sendmmsg(sock, msgs + done, count - done, flags);
+        stats.syscalls++;
+        if (r < 0) {
+            if (errno == EINTR || zc_backoff(sock, zc)) continue;
+            perror("sendmmsg");
+            return false;
+        }
+        for (int k = 0; k < r; ++k) stats.bytes += msgs[done + k].msg_len;
+        stats.packets += r;
+        if (zc) zc->sent(r);
+        done += r;
+    }
+    return true;
+}
+
+static bool gso_supported(int sock) {
+    int zero = 0; // probe only; the segment size is passed per message
+    return setsockopt(sock, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+}
+
+// UDP GSO super-datagrams built over the batch's iovec pairs.
+struct GsoBatch {
+    // Room per message for UDP_SEGMENT plus an optional SCM_TXTIME.
+    static constexpr size_t CTRL_SPACE = CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t));
+
+    std::vector<struct mmsghdr> msgs;
+    std::vector<unsigned int> segs;
+    std::vector<char> ctrl;
+    unsigned int max_segs;
+
+    GsoBatch(unsigned int batch, struct sockaddr_in6 *dst, unsigned int max_segs) : max_segs(max_segs) {
+        unsigned int n = batch; // worst case: every packet short
+        msgs.resize(n);
+        segs.resize(n);
+        ctrl.resize(n * CTRL_SPACE);
+        for (unsigned int j = 0; j < n; ++j) {
+            std::memset(&msgs[j], 0, sizeof(msgs[j]));
+            msgs[j].msg_hdr.msg_name = dst;
+            msgs[j].msg_hdr.msg_namelen = sizeof(*dst);
+        }
+    }
+};
+
+// Sends the packets described by pkt_iov (two iovecs each: header, payload)
+// as super-datagrams of up to g.max_segs segments. The kernel cuts the
+// byte stream every PKT_LEN bytes, so a super-datagram ends at the first
+// short packet.
+// If txtime is given, each super-datagram leaves at the launch time of its
+// first packet. Returns the number of packets the kernel accepted, or -1 on
+// a hard error. If the route cannot segment, *unsupported is set and the
+// caller falls back.
+static int flush_gso(int sock, GsoBatch &g, const struct iovec *pkt_iov, unsigned int count,
+                     const uint64_t *txtime, TxStats &stats, ZeroCopy *zc, bool *unsupported) {
+    unsigned int nmsgs = 0;
+    for (unsigned int first = 0, n = 0; first < count; first += n, ++nmsgs) {
+        // A short packet (a stream's last chunk) ends its super-datagram.
+        n = 1;
+        while (n < g.max_segs && first + n < count && pkt_iov[2 * (first + n) - 1].iov_len == PAYLOAD_SIZE) ++n;
+        struct msghdr &mh = g.msgs[nmsgs].msg_hdr;
+        mh.msg_iov = const_cast<struct iovec*>(pkt_iov + 2 * first);
+        mh.msg_iovlen = 2 * n;
+        mh.msg_control = g.ctrl.data() + nmsgs * GsoBatch::CTRL_SPACE;
+        g.segs[nmsgs] = n;
+        size_t used = 0;
+        if (n > 1) {
+            struct cmsghdr *cm = static_cast<struct cmsghdr*>(mh.msg_control);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = PKT_LEN;
+            std::memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+            used = CMSG_SPACE(sizeof(uint16_t));
+        }
+        if (txtime) used = put_txtime(mh, used, txtime[first]);
+        mh.msg_controllen = used;
+        if (used == 0) mh.msg_control = nullptr;
+    }
+
+    unsigned int done = 0, pkts = 0;
+    while (done < nmsgs) {
+        int r = sendmmsg(sock, g.msgs.data() + done, nmsgs - done, zc ? MSG_ZEROCOPY : 0);
+        stats.syscalls++;
+        if (r < 0) {
+            if (errno == EINTR || zc_backoff(sock, zc)) continue;
+            if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT) {
+                *unsupported = true;
+                return pkts;
+            }
+            perror("sendmmsg(UDP_SEGMENT)");
+            return -1;
+        }
+        for (int k = 0; k < r; ++k) {
+            stats.bytes += g.msgs[done + k].msg_len;
+            pkts += g.segs[done + k];
+        }
+        if (zc) zc->sent(r);
+        done += r;
+    }
+    stats.packets += pkts;
+    return pkts;
+}
+
+// Ethernet + IPv6 + UDP headers for the multicast destination, built once
+// for the raw backends. Per packet only the lengths, our stream header and
+// the UDP checksum (mandatory over IPv6) change.
+struct FrameTemplate {
+    static constexpr size_t MAX_FRAME = L2L4_LEN + PKT_LEN;
+
+    unsigned char hdr[L2L4_LEN];
+    uint32_t pseudo_sum = 0; // addresses, next header and ports
+
+    // Resolves the interface MAC and a source address of matching scope.
+    bool init(const std::string &iface, const struct sockaddr_in6 &dst) {
+        struct ifreq ifr{};
+        std::strncpy(ifr.ifr_name, iface.c_str(), IFNAMSIZ - 1);
+        int fd = ::socket(AF_INET6, SOCK_DGRAM, 0);
+        if (fd < 0 || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+            perror("ioctl(SIOCGIFHWADDR)");
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        close(fd);
+
+        struct in6_addr src{};
+        if (!source_addr(iface, IN6_IS_ADDR_MC_LINKLOCAL(&dst.sin6_addr), &src)) {
+            std::cerr << "Error: no IPv6 address on " << iface << "\n";
+            return false;
+        }
+
+        unsigned char *eth = hdr, *ip6 = hdr + 14, *udp = hdr + 54;
+        // 33:33 + low 32 bits of the group (RFC 2464)
+        eth[0] = 0x33; eth[1] = 0x33;
+        std::memcpy(eth + 2, &dst.sin6_addr.s6_addr[12], 4);
+        std::memcpy(eth + 6, ifr.ifr_hwaddr.sa_data, 6);
+        eth[12] = 0x86; eth[13] = 0xdd;
+
+        ip6[0] = 0x60; ip6[1] = 0; ip6[2] = 0; ip6[3] = 0; // version 6, no class/flow label
+        ip6[6] = IPPROTO_UDP;
+        ip6[7] = 64; // same hop limit as IPV6_MULTICAST_HOPS on the socket path
+        std::memcpy(ip6 + 8, &src, 16);
+        std::memcpy(ip6 + 24, &dst.sin6_addr, 16);
+
+        std::memcpy(udp, &dst.sin6_port, 2); // source port = destination port
+        std::memcpy(udp + 2, &dst.sin6_port, 2);
+        udp[6] = udp[7] = 0;
+
+        pseudo_sum = csum_add(0, ip6 + 8, 32);
+        pseudo_sum += IPPROTO_UDP;
+        pseudo_sum = csum_add(pseudo_sum, udp, 4);
+        return true;
+    }
+
+    // Writes the fixed Ethernet/IPv6/UDP headers; done once per ring slot.
+    void prefill(unsigned char *out) const { std::memcpy(out, hdr, L2L4_LEN); }
+
+    // Completes a prefilled frame for one packet and returns its length.
+    size_t fill(unsigned char *out, const struct iovec *pkt) const {
+        size_t dlen = pkt[0].iov_len + pkt[1].iov_len;
+        uint16_t ulen = static_cast<uint16_t>(8 + dlen);
+        unsigned char *payload = out + L2L4_LEN;
+        std::memcpy(payload, pkt[0].iov_base, pkt[0].iov_len);
+        std::memcpy(payload + pkt[0].iov_len, pkt[1].iov_base, pkt[1].iov_len);
+
+        uint16_t ulen_be = htons(ulen);
+        std::memcpy(out + 14 + 4, &ulen_be, 2); // IPv6 payload length
+        std::memcpy(out + 54 + 4, &ulen_be, 2); // UDP length
+        // Length counts twice: pseudo header and UDP header.
+        uint32_t sum = pseudo_sum + 2u * ulen;
+        sum = csum_add(sum, payload, dlen);
+        uint16_t csum = csum_fold(sum);
+        if (csum == 0) csum = 0xffff;
+        std::memcpy(out + 54 + 6, &csum, 2);
+        return L2L4_LEN + dlen;
+    }
+
+private:
+    // One's complement sum of big-endian 16-bit words (RFC 1071).
+    static uint32_t csum_add(uint32_t sum, const unsigned char *p, size_t len) {
+        uint64_t acc = sum;
+        for (; len >= 2; p += 2, len -= 2) acc += (uint32_t(p[0]) << 8) | p[1];
+        if (len) acc += uint32_t(p[0]) << 8;
+        while (acc >> 32) acc = (acc & 0xffffffffu) + (acc >> 32);
+        return static_cast<uint32_t>(acc);
+    }
+    // Folds to 16 bits and returns the complement in network byte order.
+    static uint16_t csum_fold(uint32_t sum) {
+        while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+        return htons(static_cast<uint16_t>(~sum));
+    }
+
+    static bool source_addr(const std::string &iface, bool link_local, struct in6_addr *out) {
+        struct ifaddrs *ifa_list = nullptr;
+        if (getifaddrs(&ifa_list) < 0) return false;
+        bool found = false;
+        for (struct ifaddrs *ifa = ifa_list; ifa; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET6 || iface != ifa->ifa_name) continue;
+            const struct in6_addr &a = reinterpret_cast<struct sockaddr_in6*>(ifa->ifa_addr)->sin6_addr;
+            bool ll = IN6_IS_ADDR_LINKLOCAL(&a);
+            // Prefer the scope of the group; take anything else as a fallback.
+            if (!found || ll == link_local) *out = a;
+            found = true;
+            if (ll == link_local) break;
+        }
+        freeifaddrs(ifa_list);
+        return found;
+    }
+};
+
+// AF_PACKET transmit ring (TPACKET_V3, PACKET_QDISC_BYPASS). Frames are
+// copied into ring slots, marked TP_STATUS_SEND_REQUEST, and one send()
+// per batch tells the kernel to transmit everything pending.
+class PacketRing {
+public:
+    ~PacketRing() {
+        if (ring_) munmap(ring_, ring_len_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool open(const std::string &iface, unsigned int ifindex, const struct sockaddr_in6 &dst) {
+        if (!tmpl_.init(iface, dst)) return false;
+        fd_ = ::socket(AF_PACKET, SOCK_RAW, 0); // protocol 0: transmit only
+        if (fd_ < 0) { perror("socket(AF_PACKET)"); return false; }
+        int v = TPACKET_V3;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0) {
+            perror("setsockopt(PACKET_VERSION)");
+            return false;
+        }
+        int one = 1;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+            perror("setsockopt(PACKET_QDISC_BYPASS)");
+        }
+
+        struct tpacket_req3 req{};
+        req.tp_block_size = RING_BLOCK_SIZE;
+        req.tp_block_nr = RING_BLOCK_NR;
+        req.tp_frame_size = RING_FRAME_SIZE;
+        req.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+            perror("setsockopt(PACKET_TX_RING)");
+            return false;
+        }
+        frames_ = req.tp_frame_nr;
+        ring_len_ = size_t(RING_BLOCK_SIZE) * RING_BLOCK_NR;
+        void *p = mmap(nullptr, ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) { perror("mmap(PACKET_TX_RING)"); return false; }
+        ring_ = static_cast<unsigned char*>(p);
+        // The kernel never writes the data area of a TX slot, so the
+        // headers only have to be laid down once.
+        for (unsigned int i = 0; i < frames_; ++i) {
+            tmpl_.prefill(reinterpret_cast<unsigned char*>(frame(i)) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        }
+
+        struct sockaddr_ll ll{};
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = 0; // no receive hook; the kernel takes the protocol from each frame
+        ll.sll_ifindex = static_cast<int>(ifindex);
+        if (bind(fd_, (struct sockaddr*)&ll, sizeof(ll)) < 0) { perror("bind(AF_PACKET)"); return false; }
+        return true;
+    }
+
+    // Queues the packets described by pkt_iov (header, payload pairs) and
+    // kicks the kernel once. Returns false on a hard error.
+    bool send(const struct iovec *pkt_iov, unsigned int count, TxStats &stats) {
+        for (unsigned int k = 0; k < count; ++k) {
+            struct tpacket3_hdr *ph;
+            while ((ph = frame(cur_))->tp_status != TP_STATUS_AVAILABLE) {
+                if (ph->tp_status & TP_STATUS_WRONG_FORMAT) {
+                    std::cerr << "Error: AF_PACKET rejected a frame\n";
+                    return false;
+                }
+                // Ring full: flush what is pending and wait for a free slot.
+                if (!kick(stats)) return false;
+                struct pollfd pfd{fd_, POLLOUT, 0};
+                poll(&pfd, 1, 100);
+                if (g_interrupted) return false;
+            }
+            unsigned char *data = reinterpret_cast<unsigned char*>(ph) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+            size_t len = tmpl_.fill(data, pkt_iov + 2 * k);
+            ph->tp_len = static_cast<uint32_t>(len);
+            ph->tp_snaplen = static_cast<uint32_t>(len);
+            ph->tp_next_offset = 0;
+            __atomic_store_n(&ph->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+            cur_ = (cur_ + 1) % frames_;
+            stats.packets++;
+            stats.bytes += len - L2L4_LEN;
+        }
+        return kick(stats);
+    }
+
+private:
+    static constexpr unsigned int RING_FRAME_SIZE = 2048;
+    static constexpr unsigned int RING_BLOCK_SIZE = 1 << 16;
+    static constexpr unsigned int RING_BLOCK_NR = 16;
+    static_assert(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + FrameTemplate::MAX_FRAME <= RING_FRAME_SIZE,
+                  "frame does not fit a TX ring slot");
+
+    struct tpacket3_hdr *frame(unsigned int i) {
+        return reinterpret_cast<struct tpacket3_hdr*>(ring_ + size_t(i) * RING_FRAME_SIZE);
+    }
+    bool kick(TxStats &stats) {
+        stats.syscalls++;
+        if (::send(fd_, nullptr, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+            perror("send(AF_PACKET)");
+            return false;
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    unsigned char *ring_ = nullptr;
+    size_t ring_len_ = 0;
+    unsigned int frames_ = 0;
+    unsigned int cur_ = 0;
+    FrameTemplate tmpl_;
+};
+
+// AF_XDP transmit socket. Every UMEM frame is pre-filled with the frame
+// template once; a send only patches lengths, stream header, payload and
+// checksum, posts the frame on the TX ring and recycles frames from the
+// completion ring. Binds zero-copy when the driver allows it, otherwise
+// copy mode (which is what veth and generic XDP provide).
+class XdpSocket {
+public:
+    ~XdpSocket() {
+        if (fd_ >= 0) close(fd_);
+        if (umem_) munmap(umem_, size_t(UMEM_FRAMES) * UMEM_FRAME_SIZE);
+    }
+
+    bool open(const std::string &iface, unsigned int ifindex, const struct sockaddr_in6 &dst) {
+        if (!tmpl_.init(iface, dst)) return false;
+        fd_ = ::socket(AF_XDP, SOCK_RAW, 0);
+        if (fd_ < 0) { perror("socket(AF_XDP)"); return false; }
+
+        size_t umem_len = size_t(UMEM_FRAMES) * UMEM_FRAME_SIZE;
+        void *p = mmap(nullptr, umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED) { perror("mmap(UMEM)"); return false; }
+        umem_ = static_cast<unsigned char*>(p);
+        struct xdp_umem_reg mr{};
+        mr.addr = reinterpret_cast<uint64_t>(umem_);
+        mr.len = umem_len;
+        mr.chunk_size = UMEM_FRAME_SIZE;
+        if (setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0) { perror("setsockopt(XDP_UMEM_REG)"); return false; }
+
+        // The fill ring is unused for transmit but must exist for bind().
+        int fill_n = 64, ring_n = UMEM_FRAMES;
+        if (setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING, &fill_n, sizeof(fill_n)) < 0 ||
+            setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_n, sizeof(ring_n)) < 0 ||
+            setsockopt(fd_, SOL_XDP, XDP_TX_RING, &ring_n, sizeof(ring_n)) < 0) {
+            perror("setsockopt(AF_XDP rings)");
+            return false;
+        }
+        struct xdp_mmap_offsets off{};
+        socklen_t optlen = sizeof(off);
+        if (getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) { perror("getsockopt(XDP_MMAP_OFFSETS)"); return false; }
+        if (!fill_.map(fd_, off.fr, fill_n, XDP_UMEM_PGOFF_FILL_RING) ||
+            !comp_.map(fd_, off.cr, ring_n, XDP_UMEM_PGOFF_COMPLETION_RING) ||
+            !tx_.map(fd_, off.tx, ring_n, XDP_PGOFF_TX_RING)) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < UMEM_FRAMES; ++i) {
+            tmpl_.prefill(umem_ + size_t(i) * UMEM_FRAME_SIZE);
+            free_.push_back(uint64_t(i) * UMEM_FRAME_SIZE);
+        }
+
+        struct sockaddr_xdp sxdp{};
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = ifindex;
+        sxdp.sxdp_queue_id = 0;
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+        if (bind(fd_, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) {
+            sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+            if (bind(fd_, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0) { perror("bind(AF_XDP)"); return false; }
+        } else {
+            zerocopy_ = true;
+        }
+        tx_prod_ = *tx_.producer;
+        return true;
+    }
+
+    bool zerocopy() const { return zerocopy_; }
+
+    // Posts the packets described by pkt_iov (header, payload pairs) on the
+    // TX ring and wakes the kernel. Returns false on a hard error.
+    bool send(const struct iovec *pkt_iov, unsigned int count, TxStats &stats) {
+        for (unsigned int k = 0; k < count; ++k) {
+            while (free_.empty()) {
+                if (!kick(stats)) return false;
+                reap();
+                if (!free_.empty()) break;
+                struct pollfd pfd{fd_, POLLOUT, 0};
+                poll(&pfd, 1, 1);
+                if (g_interrupted) return false;
+            }
+            uint64_t addr = free_.back();
+            free_.pop_back();
+            size_t len = tmpl_.fill(umem_ + addr, pkt_iov + 2 * k);
+            struct xdp_desc &d = tx_.ring[tx_prod_ & tx_.mask];
+            d.addr = addr;
+            d.len = static_cast<uint32_t>(len);
+            d.options = 0;
+            ++tx_prod_;
+            stats.packets++;
+            stats.bytes += len - L2L4_LEN;
+        }
+        __atomic_store_n(tx_.producer, tx_prod_, __ATOMIC_RELEASE);
+        if (!kick(stats)) return false;
+        reap();
+        return true;
+    }
+
+    // Waits until every posted frame has completed.
+    void drain(TxStats &stats) {
+        for (int tries = 0; tries < 1000 && free_.size() < UMEM_FRAMES; ++tries) {
+            if (!kick(stats)) return;
+            reap();
+            if (free_.size() < UMEM_FRAMES) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+private:
+    static constexpr uint32_t UMEM_FRAMES = 4096;
+    static constexpr uint32_t UMEM_FRAME_SIZE = 2048;
+    static_assert(FrameTemplate::MAX_FRAME <= UMEM_FRAME_SIZE, "frame does not fit a UMEM chunk");
+
+    // Copy-mode kicks in a row without the kernel consuming a descriptor
+    // before kick() gives up (about a second with the 1 ms backoff).
+    static constexpr unsigned int KICK_STALL_LIMIT = 1000;
+
+    // Copy mode transmits only inside sendto() (a bounded batch per call),
+    // so keep calling while the kernel still has unconsumed descriptors.
+    // While a call consumes nothing, reap completions and wait briefly; a
+    // queue that stops draining (link down, stalled qdisc) is an error.
+    bool kick(TxStats &stats) {
+        uint32_t cons = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+        unsigned int stalls = 0;
+        while (cons != tx_prod_ && !g_interrupted) {
+            if (zerocopy_ && !(__atomic_load_n(tx_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) return true;
+            stats.syscalls++;
+            if (sendto(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0) {
+                if (errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+                    perror("sendto(AF_XDP)");
+                    return false;
+                }
+                if (zerocopy_) return true;
+            }
+            uint32_t now = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+            if (now != cons) {
+                cons = now;
+                stalls = 0;
+                continue;
+            }
+            if (++stalls >= KICK_STALL_LIMIT) {
+                std::cerr << "Error: AF_XDP TX queue made no progress in " << KICK_STALL_LIMIT << " attempts, giving up\n";
+                return false;
+            }
+            reap();
+            struct pollfd pfd{fd_, POLLOUT, 0};
+            poll(&pfd, 1, 1);
+        }
+        return true;
+    }
+
+    void reap() {
+        uint32_t cons = *comp_.consumer;
+        uint32_t prod = __atomic_load_n(comp_.producer, __ATOMIC_ACQUIRE);
+        for (; cons != prod; ++cons) free_.push_back(comp_.ring[cons & comp_.mask]);
+        __atomic_store_n(comp_.consumer, cons, __ATOMIC_RELEASE);
+    }
+
+    int fd_ = -1;
+    unsigned char *umem_ = nullptr;
+    XskRing<uint64_t> fill_, comp_;
+    XskRing<struct xdp_desc> tx_;
+    uint32_t tx_prod_ = 0;
+    std::vector<uint64_t> free_;
+    bool zerocopy_ = false;
+    FrameTemplate tmpl_;
+};
+
+static uint64_t mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+static void sleep_until_ns(uint64_t t_ns) {
+    struct timespec ts;
+    ts.tv_sec = time_t(t_ns / 1000000000ull);
+    ts.tv_nsec = long(t_ns % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !g_interrupted) {}
+}
+
+// Sleep: userspace sleeps between flushes (default).
+// Fq: the fq qdisc spreads packets at SO_MAX_PACING_RATE; userspace still
+//     paces per flush so the flow queue stays around one batch deep.
+// Txtime: every packet carries an SCM_TXTIME launch time on an absolute
+//     schedule; userspace only wakes once per batch, TXTIME_LEAD_NS early.
+enum class PacingMode { Sleep, Fq, Txtime };
+
+// Token-bucket pacer on an absolute schedule (GCRA). tat_ns is the time at
+// which everything admitted so far has drained at the target rate; it only
+// ever advances by exact packet costs, so sleep overshoot does not add up.
+// A late sender may catch up by at most `burst` packets before the schedule
+// restarts from now. Targets are pps, or bits per second counting the
+// datagram plus WIRE_OVERHEAD bytes per packet.
+// Txtime fills launch[] for the batch from the same schedule instead of
+// sleeping per packet.
+struct Pacer {
+    PacingMode mode = PacingMode::Sleep;
+    double pps = 0.0;
+    double bps = 0.0;
+    unsigned int burst = 0;       // bucket depth in packets
+    std::vector<uint64_t> launch; // Txtime: launch times of the current batch
+
+    bool active() const { return pps > 0.0 || bps > 0.0; }
+
+    // Blocks until a flush of count packets totalling bytes (datagram bytes)
+    // conforms to the bucket.
+    void wait(unsigned int count, uint64_t bytes) {
+        if (count == 0) return;
+        uint64_t now = mono_ns();
+        if (!started_) {
+            started_ = true;
+            first_ns_ = tat_ns_ = now;
+        }
+        packets_ += count;
+        bytes_ += bytes;
+        last_count_ = count;
+        last_ns_ = now;
+        if (!active()) return;
+
+        double cost = cost_ns(count, bytes);
+        double per = cost / count;
+        if (mode == PacingMode::Txtime) {
+            // Behind schedule: restart it rather than stamp launch times in
+            // the past, which fq would let out as one burst.
+            uint64_t base = std::max<uint64_t>(tat_ns_, now + TXTIME_LEAD_NS);
+            launch.resize(count);
+            for (unsigned int k = 0; k < count; ++k) launch[k] = base + uint64_t(k * per);
+            if (base > now + TXTIME_LEAD_NS) sleep_until_ns(base - TXTIME_LEAD_NS);
+            tat_ns_ = base + uint64_t(cost);
+            return;
+        }
+
+        // The batch conforms once its last packet fits in the bucket.
+        double depth = std::max(burst, count);
+        uint64_t tolerance = uint64_t((depth - count) * per);
+        uint64_t start = tat_ns_ > tolerance ? tat_ns_ - tolerance : 0;
+        if (now < start) {
+            sleep_until_ns(start);
+            uint64_t woke = mono_ns();
+            record_error(woke - start);
+            now = woke;
+        } else if (now > tat_ns_) {
+            record_error(now - tat_ns_);
+        }
+        last_ns_ = now;
+        // Catch up after lateness of up to `depth` packets, otherwise restart.
+        uint64_t catchup = uint64_t(depth * per);
+        if (now > catchup && tat_ns_ < now - catchup) tat_ns_ = now - catchup;
+        tat_ns_ += uint64_t(cost);
+    }
+
+    void report() const {
+        if (!started_ || packets_ == 0) return;
+        // Start of first to start of last flush spans all but the last batch;
+        // extend it at the achieved spacing to cover that batch too.
+        if (packets_ <= last_count_ || last_ns_ <= first_ns_) return;
+        double elapsed = double(last_ns_ - first_ns_) / 1e9 * double(packets_) / double(packets_ - last_count_);
+        double got_pps = packets_ / elapsed;
+        double got_bps = (bytes_ + packets_ * WIRE_OVERHEAD) * 8.0 / elapsed;
+        std::cerr << "Achieved " << got_pps << " pps, " << got_bps / 1e6 << " Mbit/s";
+        if (pps > 0.0) std::cerr << " (target " << pps << " pps, " << 100.0 * (got_pps - pps) / pps << "%)";
+        if (bps > 0.0) std::cerr << " (target " << bps / 1e6 << " Mbit/s, " << 100.0 * (got_bps - bps) / bps << "%)";
+        if (errors_ > 0) {
+            std::cerr << ", schedule error mean " << double(error_sum_ns_) / errors_ / 1e3 << " us, max "
+                      << double(error_max_ns_) / 1e3 << " us";
+        }
+        std::cerr << "\n";
+    }
+
+private:
+    double cost_ns(unsigned int count, uint64_t bytes) const {
+        if (bps > 0.0) return double(bytes + count * WIRE_OVERHEAD) * 8.0 * 1e9 / bps;
+        return double(count) * 1e9 / pps;
+    }
+    void record_error(uint64_t late_ns) {
+        ++errors_;
+        error_sum_ns_ += late_ns;
+        error_max_ns_ = std::max(error_max_ns_, late_ns);
+    }
+
+    bool started_ = false;
+    uint64_t tat_ns_ = 0, first_ns_ = 0, last_ns_ = 0;
+    uint64_t packets_ = 0, bytes_ = 0;
+    unsigned int last_count_ = 0;
+    uint64_t errors_ = 0, error_sum_ns_ = 0, error_max_ns_ = 0;
+};
+
+// One carousel input of a multi-stream run: a file sent under its own
+// stream_id, optionally capped at its own rate (same wire-byte basis as -R).
+struct Stream {
+    std::string filename;
+    uint32_t id = 1;
+    double bps = 0.0;        // 0 = only the global cap applies
+    unsigned int weight = 1; // share of the link relative to the others
+    FileSource src;
+    uint32_t seq = 1;
+    bool done = false;
+    int64_t deficit = 0;     // DRR credit in datagram bytes
+    uint64_t tat_ns = 0;     // GCRA schedule of the own rate
+    uint64_t packets = 0, bytes = 0;
+};
+
+// Parses "FILE,ID[,RATE[,WEIGHT]]" as given to --stream.
+static bool parse_stream(const std::string &spec, Stream &st) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        size_t comma = spec.find(',', start);
+        parts.push_back(spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    if (parts.size() < 2 || parts.size() > 4 || parts[0].empty()) return false;
+    st.filename = parts[0];
+    st.id = static_cast<uint32_t>(std::stoul(parts[1]));
+    if (parts.size() > 2 && !parts[2].empty()) st.bps = parse_bitrate(parts[2]);
+    if (parts.size() > 3) st.weight = static_cast<unsigned int>(std::stoul(parts[3]));
+    return st.weight > 0;
+}
+
+// Deficit round robin over the streams. Each visit grants weight * PKT_LEN
+// bytes of credit and the stream is served while its credit covers a full
+// packet, so busy streams share the link by weight whatever their packet
+// sizes. A stream over its own rate is skipped without credit; pick() then
+// tells when the earliest such stream conforms again.
+class DrrScheduler {
+public:
+    static constexpr unsigned int STREAM_BURST = 8; // own-rate tolerance, packets
+
+    explicit DrrScheduler(std::vector<Stream> &streams) : streams_(streams) {}
+
+    // Returns the stream to take the next packet from, or nullptr if none
+    // may send before *wake_ns (left 0 once every stream is done).
+    Stream *pick(uint64_t now, uint64_t *wake_ns) {
+        *wake_ns = 0;
+        for (size_t visits = 0; visits <= streams_.size(); ++visits) {
+            Stream &st = streams_[cur_];
+            if (!st.done) {
+                uint64_t tol = st.bps > 0.0 ? STREAM_BURST * cost_ns(st, PKT_LEN) : 0;
+                if (st.tat_ns > now + tol) {
+                    uint64_t at = st.tat_ns - tol;
+                    if (*wake_ns == 0 || at < *wake_ns) *wake_ns = at;
+                } else {
+                    if (fresh_) {
+                        st.deficit += int64_t(st.weight) * PKT_LEN;
+                        fresh_ = false;
+                    }
+                    if (st.deficit >= int64_t(PKT_LEN)) return &st;
+                }
+            } else {
+                st.deficit = 0;
+            }
+            cur_ = (cur_ + 1) % streams_.size();
+            fresh_ = true;
+        }
+        return nullptr;
+    }
+
+    // Accounts a packet of bytes (datagram bytes) taken from st at now.
+    void charge(Stream &st, size_t bytes, uint64_t now) {
+        st.deficit -= int64_t(bytes);
+        st.packets++;
+        st.bytes += bytes;
+        if (st.bps > 0.0) st.tat_ns = std::max(st.tat_ns, now) + cost_ns(st, bytes);
+    }
+
+private:
+    static uint64_t cost_ns(const Stream &st, size_t bytes) {
+        return uint64_t(double(bytes + WIRE_OVERHEAD) * 8.0 * 1e9 / st.bps);
+    }
+
+    std::vector<Stream> &streams_;
+    size_t cur_ = 0;
+    bool fresh_ = true; // the stream at cur_ has not been granted credit yet
+};
+
+// Sends the whole file through io_uring. Slot i of the registered buffer
+// holds one packet; its header is written up front (seq and the final flag
+// follow from the file offset) and a linked READ_FIXED -> SEND pair fills
+// and transmits it. Fixed file 0 is the input, 1 the connected socket.
+// After a failed read or send nothing new is queued, but the pairs in
+// flight are still reaped before the slots go away. On return *seq is
+// the sequence after the last packet queued.
+static bool send_file_uring(Uring &ring, int file_fd, uint32_t stream_id, unsigned int batch,
+                            Pacer &pacer, TxStats &stats, uint32_t *seq) {
+    struct stat sb;
+    if (fstat(file_fd, &sb) < 0) { perror("fstat"); return false; }
+    const uint64_t size = static_cast<uint64_t>(sb.st_size);
+    const uint64_t total = (size + PAYLOAD_SIZE - 1) / PAYLOAD_SIZE;
+
+    char *slots = ring.register_buffer(URING_SLOTS * PKT_LEN);
+    if (!slots) { perror("io_uring_register(BUFFERS)"); return false; }
+
+    std::vector<unsigned int> free_slots;
+    for (unsigned int i = URING_SLOTS; i > 0; --i) free_slots.push_back(i - 1);
+    std::vector<size_t> slot_len(URING_SLOTS);
+    uint64_t next = 0;      // index of the next packet to queue
+    unsigned int inflight = 0;
+    uint64_t batch_bytes = 0;
+    bool ok = true;
+
+    while (inflight > 0 || (ok && next < total && !g_interrupted)) {
+        unsigned int count = 0;
+        while (ok && count < batch && !free_slots.empty() && next < total && !g_interrupted) {
+            unsigned int slot = free_slots.back();
+            free_slots.pop_back();
+            char *pkt = slots + slot * PKT_LEN;
+            uint64_t off = next * PAYLOAD_SIZE;
+            size_t len = static_cast<size_t>(std::min<uint64_t>(PAYLOAD_SIZE, size - off));
+            bool is_final = (next + 1 == total);
+            put_header(pkt, stream_id, *seq, is_final ? FLAG_FINAL : 0);
+            slot_len[slot] = len;
+
+            struct io_uring_sqe *rd = ring.get_sqe();
+            rd->opcode = IORING_OP_READ_FIXED;
+            rd->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            rd->fd = 0;
+            rd->addr = reinterpret_cast<uint64_t>(pkt + HDR_LEN);
+            rd->len = static_cast<uint32_t>(len);
+            rd->off = off;
+            rd->buf_index = 0;
+            rd->user_data = uint64_t(slot) << 1;
+
+            struct io_uring_sqe *tx = ring.get_sqe();
+            tx->opcode = IORING_OP_SEND;
+            tx->flags = IOSQE_FIXED_FILE;
+            tx->fd = 1;
+            tx->addr = reinterpret_cast<uint64_t>(pkt);
+            tx->len = static_cast<uint32_t>(HDR_LEN + len);
+            tx->user_data = (uint64_t(slot) << 1) | 1;
+
+            if (is_final) std::cerr << "Queued final packet seq=" << *seq << "\n";
+            ++*seq;
+            ++next;
+            ++count;
+            batch_bytes += HDR_LEN + len;
+        }
+        pacer.wait(count, batch_bytes);
+        batch_bytes = 0;
+        inflight += count;
+
+        // Block for a completion only when nothing more can be queued.
+        bool can_queue = ok && !free_slots.empty() && next < total && !g_interrupted;
+        int r = ring.enter(can_queue ? 0 : 1);
+        stats.syscalls++;
+        if (r < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            ok = false;
+            break;
+        }
+
+        while (struct io_uring_cqe *cqe = ring.peek_cqe()) {
+            unsigned int slot = static_cast<unsigned int>(cqe->user_data >> 1);
+            bool is_send = cqe->user_data & 1;
+            int res = cqe->res;
+            ring.cqe_seen();
+            if (!is_send) {
+                if (res < 0 || static_cast<size_t>(res) != slot_len[slot]) {
+                    std::cerr << "Error: io_uring read failed: " << (res < 0 ? strerror(-res) : "short read") << "\n";
+                    ok = false;
+                }
+                continue;
+            }
+            if (res < 0) {
+                if (res != -ECANCELED) std::cerr << "Error: io_uring send failed: " << strerror(-res) << "\n";
+                ok = false;
+            } else {
+                stats.packets++;
+                stats.bytes += res;
+            }
+            free_slots.push_back(slot);
+            --inflight;
+        }
+    }
+    // Without io_uring_enter the rest cannot be reaped; the slots are the
+    // ring's and outlive it, so pairs still in flight stay harmless.
+    return ok;
+}
+
 int main(int argc, char** argv) {
     std::string iface;
     std::string addr = "ff3e::1";
     int port = 12345;
     std::string filename;
+    std::vector<std::string> stream_specs;
     int pps = 0;
+    double bitrate = 0.0;
+    unsigned int burst = 0;
     uint32_t stream_id = 1;
+    unsigned int batch = 1;
+    bool gso = false;
+    bool use_mmap = false;
+    bool zerocopy = false;
+    bool use_uring = false;
+    std::string pacing = "sleep";
+    std::string backend = "socket";
 
     for (int i = 1; i < argc; ++i) {
         std::string a(argv[i]);
@@ -42,23 +1063,105 @@ int main(int argc, char** argv) {
         else if ((a == "-p" || a == "--port") && i + 1 < argc) port = std::stoi(argv[++i]);
         else if ((a == "-f" || a == "--file") && i + 1 < argc) filename = argv[++i];
         else if ((a == "-r" || a == "--pps") && i + 1 < argc) pps = std::stoi(argv[++i]);
+        else if ((a == "-R" || a == "--bitrate") && i + 1 < argc) bitrate = parse_bitrate(argv[++i]);
+        else if (a == "--burst" && i + 1 < argc) burst = static_cast<unsigned int>(std::stoul(argv[++i]));
         else if ((a == "-S" || a == "--stream-id") && i + 1 < argc) stream_id = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (a == "--stream" && i + 1 < argc) stream_specs.push_back(argv[++i]);
+        else if ((a == "-b" || a == "--batch") && i + 1 < argc) batch = static_cast<unsigned int>(std::stoul(argv[++i]));
+        else if (a == "-G" || a == "--gso") gso = true;
+        else if (a == "-m" || a == "--mmap") use_mmap = true;
+        else if (a == "-Z" || a == "--zerocopy") zerocopy = true;
+        else if (a == "-U" || a == "--uring") use_uring = true;
+        else if ((a == "-P" || a == "--pacing") && i + 1 < argc) pacing = argv[++i];
+        else if ((a == "-B" || a == "--backend") && i + 1 < argc) backend = argv[++i];
         else if (a == "-h" || a == "--help") {
-            std::cerr << "Usage: " << argv[0] << " -f file [-S stream_id] [-a addr] [-p port] [-i iface] [-r pps]\n";
+            std::cerr << "Usage: " << argv[0] << " {-f file [-S stream_id] | --stream file,id[,rate[,weight]] ...} [-a addr] [-p port] [-i iface] [-r pps | -R bitrate] [--burst pkts]"
+                      << " [-b batch] [-G] [-m] [-Z] [-U] [-P sleep|fq|txtime] [-B socket|packet|xdp]\n";
             return 1;
         }
     }
 
-    if (filename.empty()) {
-        std::cerr << "Error: -f file is required\n";
+    // -f/-S is shorthand for a single stream; --stream adds more.
+    std::vector<Stream> streams(stream_specs.size() + (filename.empty() ? 0 : 1));
+    if (!filename.empty()) {
+        streams[0].filename = filename;
+        streams[0].id = stream_id;
+    }
+    for (size_t k = 0; k < stream_specs.size(); ++k) {
+        if (!parse_stream(stream_specs[k], streams[streams.size() - stream_specs.size() + k])) {
+            std::cerr << "Error: bad --stream " << stream_specs[k] << " (expected file,id[,rate[,weight]])\n";
+            return 2;
+        }
+    }
+    if (streams.empty()) {
+        std::cerr << "Error: -f file or --stream is required\n";
+        return 2;
+    }
+    if (use_uring && streams.size() > 1) {
+        std::cerr << "Error: -U sends a single stream\n";
+        return 2;
+    }
+    if (use_uring && (gso || use_mmap || zerocopy)) {
+        std::cerr << "Error: -U cannot be combined with -G, -m or -Z\n";
         return 2;
     }
+    PacingMode pacing_mode = PacingMode::Sleep;
+    if (pacing == "fq") pacing_mode = PacingMode::Fq;
+    else if (pacing == "txtime") pacing_mode = PacingMode::Txtime;
+    else if (pacing != "sleep") {
+        std::cerr << "Error: unknown pacing mode: " << pacing << "\n";
+        return 2;
+    }
+    if (pps > 0 && bitrate > 0.0) {
+        std::cerr << "Error: give either -r pps or -R bitrate\n";
+        return 2;
+    }
+    if (pacing_mode != PacingMode::Sleep && pps <= 0 && bitrate <= 0.0) {
+        std::cerr << "Error: -P " << pacing << " needs a rate (-r or -R)\n";
+        return 2;
+    }
+    if (pacing_mode == PacingMode::Txtime && use_uring) {
+        std::cerr << "Error: -P txtime cannot be combined with -U\n";
+        return 2;
+    }
+    const bool raw_packet = (backend == "packet");
+    const bool raw_xdp = (backend == "xdp");
+    if (!raw_packet && !raw_xdp && backend != "socket") {
+        std::cerr << "Error: unknown backend: " << backend << "\n";
+        return 2;
+    }
+    if ((raw_packet || raw_xdp) && (gso || zerocopy || use_uring || pacing_mode != PacingMode::Sleep)) {
+        std::cerr << "Error: -B " << backend << " cannot be combined with -G, -Z, -U or -P\n";
+        return 2;
+    }
+    if ((raw_packet || raw_xdp) && iface.empty()) {
+        std::cerr << "Error: -B " << backend << " needs an interface (-i)\n";
+        return 2;
+    }
+    const unsigned int batch_req = batch; // as given with -b, before the defaults below
+    if (raw_xdp && batch == 1) batch = 64;
+    if (batch < 1) batch = 1;
+    if (gso && batch == 1) batch = GSO_MAX_SEGS;
+    if (use_uring && batch == 1) batch = URING_SLOTS / 4;
+    if (batch > UIO_MAXIOV) batch = UIO_MAXIOV;
+    if (use_uring && batch > URING_SLOTS) batch = URING_SLOTS;
+
+    Uring ring;
+    if (use_uring && !ring.init(URING_ENTRIES)) {
+        perror("io_uring_setup");
+        std::cerr << "Warning: io_uring unavailable, using the synchronous send loop\n";
+        use_uring = false;
+        batch = std::min<unsigned int>(std::max(batch_req, 1u), UIO_MAXIOV); // drop the io_uring default
+    }
 
-    std::ifstream infile(filename, std::ios::binary);
-    if (!infile) {
-        std::cerr << "Error: cannot open file: " << filename << "\n";
-        return 3;
+    int file_fd = use_uring ? ::open(streams[0].filename.c_str(), O_RDONLY) : -1;
+    for (Stream &st : streams) {
+        if (use_uring ? file_fd < 0 : !st.src.open(st.filename, use_mmap)) {
+            std::cerr << "Error: cannot open file: " << st.filename << "\n";
+            return 3;
+        }
     }
+    const bool mapped = !use_uring && streams[0].src.mapped();
 
     signal(SIGINT, sigint_handler);
     signal(SIGTERM, sigint_handler);
@@ -95,79 +1198,255 @@ int main(int argc, char** argv) {
     }
     dst.sin6_scope_id = ifindex;
 
-    std::vector<char> buf(HDR_LEN + PAYLOAD_SIZE);
-    uint32_t seq = 1;
-    double interval = 0.0;
-    if (pps > 0) interval = 1.0 / double(pps);
-    auto last = std::chrono::steady_clock::now();
+    if (gso && !gso_supported(sock)) {
+        std::cerr << "Warning: kernel lacks UDP GSO, falling back to per-packet sends\n";
+        gso = false;
+    }
 
-    std::cerr << "Sending " << filename << " as stream_id=" << stream_id << " -> [" << addr << "]:" << port
-              << " (iface=" << iface << ", pps=" << pps << ")\n";
+    int one = 1;
+    if (zerocopy && setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        perror("setsockopt(SO_ZEROCOPY)");
+        std::cerr << "Warning: zero-copy unavailable, sending with copies\n";
+        zerocopy = false;
+    }
 
-    while (!g_interrupted) {
-        infile.read(buf.data() + HDR_LEN, PAYLOAD_SIZE);
-        std::streamsize n = infile.gcount();
+    if (pacing_mode == PacingMode::Fq) {
+        // bytes per second, on the same wire-byte basis as -R
+        uint64_t rate = bitrate > 0.0 ? uint64_t(bitrate / 8.0) : uint64_t(pps) * (PKT_LEN + WIRE_OVERHEAD);
+        if (setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) < 0) {
+            perror("setsockopt(SO_MAX_PACING_RATE)");
+            pacing_mode = PacingMode::Sleep;
+        }
+    } else if (pacing_mode == PacingMode::Txtime) {
+        struct sock_txtime cfg{};
+        cfg.clockid = CLOCK_MONOTONIC;
+        if (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) < 0) {
+            perror("setsockopt(SO_TXTIME)");
+            pacing_mode = PacingMode::Sleep;
+        }
+    }
+    if (pacing_mode == PacingMode::Sleep && pacing != "sleep") {
+        std::cerr << "Warning: kernel pacing unavailable, pacing in userspace\n";
+    }
 
-        // If no bytes read and EOF, we're done
-        if (n <= 0) {
-            // file fully sent already (this handles exact-multiple sizes)
-            break;
+    PacketRing packet_ring;
+    if (raw_packet && !packet_ring.open(iface, ifindex, dst)) {
+        std::cerr << "Error: cannot set up the AF_PACKET TX ring on " << iface << "\n";
+        close(sock);
+        return 4;
+    }
+    XdpSocket xsk;
+    if (raw_xdp) {
+        if (!xsk.open(iface, ifindex, dst)) {
+            std::cerr << "Error: cannot set up the AF_XDP socket on " << iface << "\n";
+            close(sock);
+            return 4;
         }
+        std::cerr << "AF_XDP socket bound in " << (xsk.zerocopy() ? "zero-copy" : "copy") << " mode\n";
+    }
 
-        // Determine if this is the final chunk:
-        // final if we read less than PAYLOAD_SIZE OR if EOF is set after read
-        bool is_final = (static_cast<size_t>(n) < PAYLOAD_SIZE) || infile.eof();
+    if (use_uring) {
+        // IORING_OP_SEND carries no address, so fix the destination.
+        int fds[2] = {file_fd, sock};
+        if (connect(sock, (struct sockaddr*)&dst, sizeof(dst)) < 0) {
+            perror("connect");
+            close(sock);
+            return 4;
+        }
+        if (ring.register_files(fds, 2) < 0) {
+            perror("io_uring_register(FILES)");
+            close(sock);
+            return 4;
+        }
+    }
+
+    std::vector<char> buf(HDR_LEN + PAYLOAD_SIZE);
+    Pacer pacer;
+    pacer.mode = pacing_mode;
+    pacer.pps = pps > 0 ? double(pps) : 0.0;
+    pacer.bps = bitrate;
+    // Default depth leaves room to absorb a batch worth of sleep overshoot.
+    pacer.burst = burst ? burst : std::max(4u, 2 * batch);
+    const bool txtime = (pacing_mode == PacingMode::Txtime);
+
+    // Batch slots: packet k is the iovec pair iov[2k] (header from hdrs[k])
+    // and iov[2k+1] (payload, in scratch[k*PAYLOAD_SIZE] or in the mapping).
+    // Zero-copy rotates ZC_SETS of them; a set is refilled only after the
+    // kernel released every send made from it (last_id).
+    struct SlotSet {
+        std::vector<std::array<char, HDR_LEN>> hdrs;
+        std::vector<char> scratch;
+        std::vector<struct iovec> iov;
+        std::vector<struct mmsghdr> msgs;
+        std::vector<char> ctrl; // SCM_TXTIME per packet
+        uint32_t last_id = 0;
+        bool in_flight = false;
+    };
+    std::vector<SlotSet> sets(use_uring ? 0 : zerocopy ? ZC_SETS : 1);
+    for (SlotSet &set : sets) {
+        set.hdrs.resize(batch);
+        set.scratch.resize(mapped ? 0 : batch * PAYLOAD_SIZE);
+        set.iov.resize(2 * batch);
+        set.msgs.resize(batch);
+        set.ctrl.resize(txtime ? batch * CMSG_SPACE(sizeof(uint64_t)) : 0);
+        for (unsigned int k = 0; k < batch; ++k) {
+            set.iov[2*k].iov_base = set.hdrs[k].data();
+            set.iov[2*k].iov_len = HDR_LEN;
+            std::memset(&set.msgs[k], 0, sizeof(set.msgs[k]));
+            set.msgs[k].msg_hdr.msg_name = &dst;
+            set.msgs[k].msg_hdr.msg_namelen = sizeof(dst);
+            set.msgs[k].msg_hdr.msg_iov = &set.iov[2*k];
+            set.msgs[k].msg_hdr.msg_iovlen = 2;
+            if (txtime) set.msgs[k].msg_hdr.msg_control = set.ctrl.data() + k * CMSG_SPACE(sizeof(uint64_t));
+        }
+    }
+    unsigned int cur = 0;
+    GsoBatch gso_batch(batch, &dst, zerocopy ? ZC_GSO_MAX_SEGS : GSO_MAX_SEGS);
+    ZeroCopy zc_state(2 * ZC_SETS * batch);
+    ZeroCopy *zc = zerocopy ? &zc_state : nullptr;
+    TxStats stats;
+
+    for (const Stream &st : streams) {
+        std::cerr << "Sending " << st.filename << " as stream_id=" << st.id;
+        if (streams.size() > 1) std::cerr << " (rate=" << st.bps << ", weight=" << st.weight << ")";
+        std::cerr << "\n";
+    }
+    std::cerr << "  -> [" << addr << "]:" << port
+              << " (iface=" << iface << ", pps=" << pps << ", bitrate=" << bitrate << ", batch=" << batch << ", gso=" << (gso ? "on" : "off")
+              << ", input=" << (use_uring ? "io_uring" : mapped ? "mmap" : "read")
+              << ", zerocopy=" << (zc ? "on" : "off") << ", pacing=" << pacing << ", backend=" << backend << ")\n";
 
-        uint32_t sid_be = htonl(stream_id);
-        uint32_t seq_be = htonl(seq);
-        uint32_t flags_be = htonl(is_final ? FLAG_FINAL : 0);
+    DrrScheduler sched(streams);
+    bool done = false;
+    std::vector<const Stream*> finished; // streams whose final packet is in the batch
+    if (use_uring) {
+        bool sent = send_file_uring(ring, file_fd, streams[0].id, batch, pacer, stats, &streams[0].seq);
+        close(file_fd);
+        if (!sent) {
+            std::cerr << "Error: io_uring transfer failed after " << stats.packets << " packets\n";
+            close(sock);
+            return 6;
+        }
+        streams[0].done = done = true;
+    }
+    while (!g_interrupted && !done) {
+        SlotSet &set = sets[cur];
+        cur = (cur + 1) % sets.size();
+        if (zc) {
+            zc->reap(sock, 0);
+            while (set.in_flight && !zc->released(set.last_id) && !g_interrupted) zc->reap(sock, 100);
+        }
+        std::vector<struct iovec> &iov = set.iov;
 
-        std::memcpy(buf.data(), &sid_be, 4);
-        std::memcpy(buf.data()+4, &seq_be, 4);
-        std::memcpy(buf.data()+8, &flags_be, 4);
+        unsigned int count = 0;
+        uint64_t batch_bytes = 0;
+        uint64_t now = mono_ns();
+        finished.clear();
+        while (count < batch) {
+            uint64_t wake_ns = 0;
+            Stream *st = sched.pick(now, &wake_ns);
+            if (!st) {
+                if (wake_ns == 0) done = true; // every file fully sent
+                if (count > 0 || done || g_interrupted) break;
+                // all streams are at their own rate: wait for the earliest
+                sleep_until_ns(wake_ns);
+                now = mono_ns();
+                continue;
+            }
+            const char *payload = nullptr;
+            bool is_final = false;
+            size_t n = st->src.next(set.scratch.data() + count * PAYLOAD_SIZE, &payload, &is_final);
+            if (n == 0) {
+                // file fully sent already
+                st->done = true;
+                continue;
+            }
 
-        size_t tosend = HDR_LEN + static_cast<size_t>(n);
+            put_header(set.hdrs[count].data(), st->id, st->seq, is_final ? FLAG_FINAL : 0);
+            iov[2*count+1].iov_base = const_cast<char*>(payload);
+            iov[2*count+1].iov_len = n;
+            ++count;
+            batch_bytes += HDR_LEN + n;
+            sched.charge(*st, HDR_LEN + n, now);
 
-        if (interval > 0.0) {
-            auto now = std::chrono::steady_clock::now();
-            std::chrono::duration<double> elapsed = now - last;
-            if (elapsed.count() < interval) {
-                std::this_thread::sleep_for(std::chrono::duration<double>(interval - elapsed.count()));
+            if (is_final) {
+                finished.push_back(st);
+                st->done = true;
             }
-            last = std::chrono::steady_clock::now();
+            ++st->seq; // after the final packet: seq of the final marker
         }
+        if (count == 0) break;
 
-        ssize_t wrote = sendto(sock, buf.data(), tosend, 0, (struct sockaddr*)&dst, sizeof(dst));
-        if (wrote < 0) {
-            perror("sendto");
-            break;
+        pacer.wait(count, batch_bytes);
+        if (txtime) {
+            for (unsigned int k = 0; k < count; ++k) {
+                set.msgs[k].msg_hdr.msg_controllen = put_txtime(set.msgs[k].msg_hdr, 0, pacer.launch[k]);
+            }
         }
 
-        if (is_final) {
-            std::cerr << "Sent final packet seq=" << seq << "\n";
-            ++seq; // increment for the final marker consistency
-            break;
+        if (raw_packet || raw_xdp) {
+            if (raw_packet ? !packet_ring.send(iov.data(), count, stats) : !xsk.send(iov.data(), count, stats)) break;
+            for (const Stream *st : finished) std::cerr << "Sent final packet stream_id=" << st->id << " seq=" << st->seq - 1 << "\n";
+            continue;
+        }
+
+        unsigned int sent = 0;
+        if (gso) {
+            bool unsupported = false;
+            int r = flush_gso(sock, gso_batch, iov.data(), count, txtime ? pacer.launch.data() : nullptr,
+                              stats, zc, &unsupported);
+            if (r < 0) break;
+            sent = r;
+            if (unsupported) {
+                std::cerr << "Warning: UDP GSO refused on this route (" << strerror(errno)
+                          << "), falling back to per-packet sends\n";
+                gso = false;
+            }
+        }
+        if (sent < count && !flush_batch(sock, set.msgs.data() + sent, count - sent, stats, zc)) break;
+        if (zc) {
+            set.last_id = zc->next_id() - 1;
+            set.in_flight = true;
+        }
+        for (const Stream *st : finished) std::cerr << "Sent final packet stream_id=" << st->id << " seq=" << st->seq - 1 << "\n";
+    }
+
+    if (raw_xdp) xsk.drain(stats);
+
+    if (stats.syscalls > 0) {
+        std::cerr << "Sent " << stats.packets << " packets (" << stats.bytes << " bytes) in " << stats.syscalls
+                  << " syscalls, " << double(stats.packets) / double(stats.syscalls) << " packets/syscall\n";
+    }
+    pacer.report();
+    if (zc) {
+        // Wait for outstanding completions before the buffers and mapping go away.
+        for (int tries = 0; tries < 20 && !zc->idle(); ++tries) zc->reap(sock, 100);
+        std::cerr << "Zero-copy: " << zc->zerocopy << " sends ran zero-copy, " << zc->copied
+                  << " copied by the kernel" << (zc->idle() ? "" : " (some completions still pending)") << "\n";
+    }
+
+    if (streams.size() > 1) {
+        for (const Stream &st : streams) {
+            std::cerr << "  stream_id=" << st.id << ": " << st.packets << " packets (" << st.bytes << " bytes)\n";
         }
-        ++seq;
     }
 
     // If interrupted before we've sent final, try to send a final marker
     if (g_interrupted) {
-        uint32_t sid_be = htonl(stream_id), seq_be = htonl(seq), flags_be = htonl(FLAG_FINAL);
-        std::memcpy(buf.data(), &sid_be, 4);
-        std::memcpy(buf.data()+4, &seq_be, 4);
-        std::memcpy(buf.data()+8, &flags_be, 4);
-        sendto(sock, buf.data(), HDR_LEN, 0, (struct sockaddr*)&dst, sizeof(dst));
-        std::cerr << "Interrupted: sent final marker seq=" << seq << "\n";
+        for (const Stream &st : streams) {
+            if (st.done) continue;
+            put_header(buf.data(), st.id, st.seq, FLAG_FINAL);
+            sendto(sock, buf.data(), HDR_LEN, 0, (struct sockaddr*)&dst, sizeof(dst));
+            std::cerr << "Interrupted: sent final marker stream_id=" << st.id << " seq=" << st.seq << "\n";
+        }
     }
 
     // send final marker a few times to increase chance of reception
     for (int i = 0; i < 3; ++i) {
-        uint32_t sid_be = htonl(stream_id), seq_be = htonl(seq), flags_be = htonl(FLAG_FINAL);
-        std::memcpy(buf.data(), &sid_be, 4);
-        std::memcpy(buf.data()+4, &seq_be, 4);
-        std::memcpy(buf.data()+8, &flags_be, 4);
-        sendto(sock, buf.data(), HDR_LEN, 0, (struct sockaddr*)&dst, sizeof(dst));
+        for (const Stream &st : streams) {
+            put_header(buf.data(), st.id, st.seq, FLAG_FINAL);
+            sendto(sock, buf.data(), HDR_LEN, 0, (struct sockaddr*)&dst, sizeof(dst));
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(200));
     }
 